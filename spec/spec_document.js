@@ -120,4 +120,159 @@ describe('A new document', function() {
     });
     assertEqual(control, doc.toString());
   });
+
+  it('reports the native memory behind it', function() {
+    var doc = new libxml.Document();
+    var empty = doc.memoryUsage();
+    assert(empty > 0);
+
+    doc.node('root', function(n) {
+      n.node('child', {to: 'wongfoo'}, 'with love');
+    });
+    assert(doc.memoryUsage() > empty);
+
+    var parsed = libxml.parseString(doc.toString());
+    assert(parsed.memoryUsage() > 0);
+
+    // moving a node moves its charge
+    var before = doc.memoryUsage();
+    var parsedBefore = parsed.memoryUsage();
+    parsed.root().addChild(doc.get('child'));
+    assert(doc.memoryUsage() < before);
+    assert(parsed.memoryUsage() > parsedBefore);
+  });
+
+  it('can be disposed of', function() {
+    var doc = libxml.parseString('<root><child>text</child></root>');
+    var child = doc.get('child');
+    var children = doc.children();
+    doc.dispose();
+
+    assertEqual(0, doc.memoryUsage());
+    var errors = 0;
+    try { child.text(); } catch (e) { errors++; }
+    try { doc.root(); } catch (e) { errors++; }
+    try { children.item(0); } catch (e) { errors++; }
+    assertEqual(3, errors);
+
+    // nodes never attached to the tree go with it
+    doc = libxml.parseString('<root/>');
+    var loose = new libxml.Element(doc, 'loose');
+    var inner = loose.node('inner');
+    doc.dispose();
+    errors = 0;
+    try { loose.name(); } catch (e) { errors++; }
+    try { inner.doc(); } catch (e) { errors++; }
+    assertEqual(2, errors);
+
+    // a second dispose does nothing
+    doc.dispose();
+  });
+
+  it('can be built from JsonML', function() {
+    var control = [
+      '<?xml version="1.0" encoding="UTF-8"?>',
+      '<root><child to="wongfoo"><grandchild from="julie numar">with love</grandchild></child><sibling>with content! 2</sibling></root>',
+      ''
+    ].join("\n");
+
+    var doc = new libxml.Document();
+    libxml.build(doc, ['root',
+                        ['child', {to: 'wongfoo'},
+                          ['grandchild', {from: 'julie numar'}, 'with love']],
+                        ['sibling', 'with content! ', 2]]);
+    assertEqual(control, doc.toString());
+
+    libxml.build(doc.root(), ['added']);
+    assertEqual('added', doc.child(-1).name());
+  });
+
+  it('will not build JsonML that contains itself', function() {
+    var looped = ['root'];
+    looped.push(looped);
+
+    var doc = new libxml.Document();
+    var thrown = 0;
+    try { libxml.build(doc, looped); } catch (e) { thrown++; }
+    assertEqual(1, thrown);
+    assertEqual(null, doc.root());
+  });
+
+  it('can be serialized in chunks', function() {
+    var doc = libxml.parseString('<root><child to="wongfoo">with love</child></root>');
+    var chunks = [];
+    doc.serialize({chunkSize: 16}, function(chunk) {
+      chunks.push(chunk);
+    });
+
+    assert(chunks.length > 1);
+    assertEqual(16, chunks[0].length);
+    assertEqual(doc.toString(), chunks.join(''));
+
+    var body = '';
+    doc.serialize({declaration: false}, function(chunk) { body += chunk; });
+    assertEqual('<root><child to="wongfoo">with love</child></root>\n', body);
+
+    var errors = 0;
+    try {
+      doc.serialize({chunkSize: 1}, function(chunk) { throw 'stop'; });
+    } catch (e) {
+      assertEqual('stop', e);
+      errors++;
+    }
+    try { doc.serialize({encoding: 'NOT-AN-ENCODING'}, function() {}); } catch (e) { errors++; }
+    assertEqual(2, errors);
+
+    // the tree can't change under the serializer
+    var child = doc.get('child');
+    var blocked = 0;
+    doc.serialize({chunkSize: 16}, function(chunk) {
+      try { child.text('changed'); } catch (e) { blocked++; }
+      try { doc.dispose(); } catch (e) { blocked++; }
+    });
+    assertEqual(2 * chunks.length, blocked);
+    assertEqual('with love', child.text());
+  });
+
+  it('can be saved to a file', function() {
+    var doc = libxml.parseString('<root><child>text</child></root>');
+    var filename = '/tmp/libxmljs_spec_save.xml';
+    var written = doc.saveFile(filename, {format: true});
+    var contents = posix.cat(filename).wait();
+
+    assertEqual(contents.length, written);
+    assertEqual('text', libxml.parseString(contents).get('child').text());
+    assertEqual(doc.toString(), libxml.parseString(contents).toString());
+  });
+
+  it('is read-only while serialized on a thread', function() {
+    var doc = libxml.parseString('<root><child>text</child></root>');
+    var control = doc.toString();
+    var child = doc.get('child');
+
+    doc.toStringAsync(function(err, buffer) {
+      assertEqual(null, err);
+      assertEqual(control, buffer.toString());
+
+      // writable again
+      child.text('changed');
+      assertEqual('changed', doc.get('child').text());
+    });
+
+    var errors = 0;
+    try { child.text('changed'); } catch (e) { errors++; }
+    try { child.attr({id: '1'}); } catch (e) { errors++; }
+    try { doc.node('other'); } catch (e) { errors++; }
+    try { doc.dispose(); } catch (e) { errors++; }
+    assertEqual(4, errors);
+
+    // reads still work, the encoding included while a job encodes
+    assertEqual('text', child.text());
+    var encoding = doc.encoding();
+    doc.toStringAsync({encoding: 'ISO-8859-1'}, function(err, buffer) {
+      assertEqual(null, err);
+      assertEqual(control.length, buffer.length + 'UTF-8'.length - 'ISO-8859-1'.length);
+    });
+    assertEqual(encoding, doc.encoding());
+  });
 });
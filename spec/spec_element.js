@@ -71,4 +71,67 @@ describe('An element node', function() {
     assertEqual('/root/child[1]/grandchild', gchild.path());
     assertEqual('/root/child[2]', sibling.path());
   });
+
+  it('can be converted to a plain object', function() {
+    var doc = libxml.parseString(
+      '<entry id="1">a<![CDATA[b]]><link href="x"/>c</entry>');
+
+    var obj = doc.root().toObject();
+    assertEqual('entry', obj.name);
+    assertEqual('1', obj.attrs.id);
+    assertEqual(3, obj.children.length);
+    assertEqual('ab', obj.children[0]);
+    assertEqual('link', obj.children[1].name);
+    assertEqual('x', obj.children[1].attrs.href);
+    assertEqual('c', obj.children[2]);
+
+    obj = doc.toObject({coalesce: false, attrPrefix: '@'});
+    assertEqual('1', obj['@id']);
+    assertEqual(undefined, obj.attrs);
+    assertEqual(4, obj.children.length);
+    assertEqual('a', obj.children[0]);
+  });
+
+  it('expands entity references when converted to an object', function() {
+    var doc = libxml.parseString(
+      '<?xml version="1.0"?>' +
+      '<!DOCTYPE entry [<!ENTITY e "b<i>c</i>d">]>' +
+      '<entry>a&e;<!-- note --><?pi x?>e</entry>');
+
+    var obj = doc.toObject();
+    assertEqual(3, obj.children.length);
+    assertEqual('ab', obj.children[0]);
+    assertEqual('i', obj.children[1].name);
+    assertEqual('c', obj.children[1].children[0]);
+    assertEqual('de', obj.children[2]);
+  });
+
+  it('returns the same text when it is read as an external string', function() {
+    var text = '';
+    for (var i = 0; i < 256; i++)
+      text += 'QUJDREVGR0g=';
+    var doc = libxml.parseString('<root a="' + text + '">' + text + '</root>');
+
+    var threshold = libxml.externalStringThreshold();
+    libxml.externalStringThreshold(16);
+    assertEqual(16, libxml.externalStringThreshold());
+    assertEqual(text, doc.root().text());
+    assertEqual(text, doc.root().attr('a').value());
+    assertEqual('caf\u00e9' + text, doc.root().text('caf\u00e9' + text).text());
+    libxml.externalStringThreshold(threshold);
+  });
+
+  it('can be serialized without the rest of the document', function() {
+    var doc = libxml.parseString(
+      '<root><entry id="1">caf\u00e9<b>bold</b></entry><entry id="2"/></root>');
+    var entry = doc.get('entry');
+
+    assertEqual('<entry id="1">caf\u00e9<b>bold</b></entry>', entry.toString());
+    assertEqual('<entry id="2"/>', doc.child(1).toString());
+    assertEqual('<b>bold</b>', entry.toString({format: true}).match(/<b>.*<\/b>/)[0]);
+
+    // a Buffer with one byte per character, the e-acute included
+    var latin1 = entry.toString({encoding: 'ISO-8859-1'});
+    assertEqual(entry.toString().length, latin1.length);
+  });
 });
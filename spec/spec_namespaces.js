@@ -87,4 +87,15 @@ describe('A namespace', function() {
     elem.namespace(null);
     assert(!elem.namespace());
   });
+
+  it('of the xml: prefix is detached when its document is disposed', function() {
+    var doc = libxml.parseString('<root xml:lang="en"/>');
+    var ns = doc.root().attr('lang').namespace();
+    assertEqual('http://www.w3.org/XML/1998/namespace', ns.href());
+
+    doc.dispose();
+    var errors = 0;
+    try { ns.href(); } catch (e) { errors++; }
+    assertEqual(1, errors);
+  });
 });
@@ -74,4 +74,17 @@ describe('A node attribute', function() {
                   .attr({foo: 'bar'});
     assertEqual(doc, elem.attr('foo').doc());
   });
+
+  it('can be retrieved as a plain object', function() {
+    var doc = libxml.parseString(
+      '<name to="wongfoo" from="julie numar" xml:lang="en" />');
+    var attrs = doc.root().attrsObject();
+    assertEqual('wongfoo', attrs.to);
+    assertEqual('julie numar', attrs.from);
+    assertEqual('en', attrs.lang);
+
+    attrs = doc.root().attrsObject({qualified: true});
+    assertEqual('en', attrs['xml:lang']);
+    assertEqual(undefined, attrs.lang);
+  });
 });
@@ -29,4 +29,67 @@ describe('Parsing', function() {
     assertEqual('sibling', doc.get('sibling').name());
     assertEqual('with content!', doc.get('sibling').text());
   });
+
+  it('can be done into an arena', function() {
+    var str = posix.cat(filename).wait();
+
+    var doc = libxml.parseString(str, {arena: true});
+    assertEqual('with love', doc.get('child/grandchild').text());
+    doc.root().node('added', 'after parsing');
+    assertEqual('after parsing', doc.get('added').text());
+
+    doc = libxml.parseFile(filename, {arena: true});
+    assertEqual('sibling', doc.get('sibling').name());
+
+    // arena nodes can't outlive their document in another one
+    var other = libxml.parseString('<other/>');
+    var moved = 0;
+    try { other.root().addChild(doc.get('sibling')); } catch (e) { moved++; }
+    assertEqual(1, moved);
+    assertEqual(0, other.root().childCount());
+  });
+});
+
+describe('Converting to objects', function() {
+  var str = '<feed lang="en"><title>t</title>' +
+            '<entry id="1">a</entry><entry id="2">b</entry>' +
+            '<link href="x"/></feed>';
+
+  it('can convert a string', function() {
+    var obj = libxml.parseStringToObject(str);
+    assertEqual('en', obj.feed['@lang']);
+    assertEqual('t', obj.feed.title);
+    assertEqual(2, obj.feed.entry.length);
+    assertEqual('2', obj.feed.entry[1]['@id']);
+    assertEqual('b', obj.feed.entry[1]['#text']);
+    assertEqual('x', obj.feed.link['@href']);
+  });
+
+  it('can take a mapping convention', function() {
+    var obj = libxml.parseStringToObject(str, {
+      attrPrefix: '$',
+      textKey: '_',
+      arrays: ['/feed/title', 'link']
+    });
+    assertEqual('en', obj.feed.$lang);
+    assertEqual('a', obj.feed.entry[0]._);
+    assertEqual('t', obj.feed.title[0]);
+    assertEqual('x', obj.feed.link[0].$href);
+  });
+
+  it('ignores empty array entries', function() {
+    var obj = libxml.parseStringToObject(str, {arrays: ['', 'link']});
+    assertEqual('t', obj.feed.title);
+    assertEqual('x', obj.feed.link[0]['@href']);
+  });
+
+  it('always gives parse errors a message', function() {
+    var message = '';
+    try {
+      libxml.parseFileToObject('/does/not/exist.xml');
+    } catch (e) {
+      message = e.message;
+    }
+    assert(message.length > 0);
+  });
 });
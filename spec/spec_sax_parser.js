@@ -65,6 +65,87 @@ describe("SAX Push Parser", function() {
     assertEqual(JSON.stringify(callbackControl), JSON.stringify(callbacks));
   });
 
+  it('will properly parse a regular string on a parse thread', function() {
+    var str = posix.cat(filename).wait();
+    var parser = createParser('SaxParser');
+    parser.threaded(true);
+    assert(parser.threaded());
+    parser.parseString(str);
+    assertEqual(JSON.stringify(callbackControl), JSON.stringify(callbacks));
+  });
+
+  it('will properly parse a file on a parse thread', function() {
+    var parser = createParser('SaxParser');
+    parser.threaded(true);
+    parser.parseFile(filename);
+    assertEqual(JSON.stringify(callbackControl), JSON.stringify(callbacks));
+  });
+
+  it('will only deliver events inside filtered paths', function() {
+    var str = posix.cat(filename).wait();
+    var parser = createParser('SaxParser');
+    parser.filter(['/error/stream:stream/message/body', '//html']);
+    assertEqual(2, parser.filter().length);
+    parser.parseString(str);
+
+    var names = [];
+    for (var i = 0; i < callbacks.startElementNS.length; i++)
+      names.push(callbacks.startElementNS[i][0]);
+
+    assertEqual('body,html,body', names.join(','));
+    assertEqual(3, callbacks.endElementNS.length);
+    assertEqual(2, callbacks.characters.length);
+    assertEqual(0, callbacks.cdata.length);
+    assertEqual(0, callbacks.comment.length);
+  });
+
+  it('can skip the rest of an element from a callback', function() {
+    var str = posix.cat(filename).wait();
+    var names = [];
+    var parser = new libxml.SaxParser(function(cb) {
+      cb.onStartElementNS(function(elem) {
+        names.push(elem);
+        if (elem == 'message')
+          return libxml.SaxParser.SKIP_SUBTREE;
+      });
+      cb.onEndElementNS(function(elem) {
+        names.push('/' + elem);
+      });
+    });
+    parser.parseString(str);
+    assertEqual('error,stream,message,/message,prefixed,/prefixed,/stream',
+                names.join(','));
+  });
+
+  it('ignores ordinary return values from callbacks', function() {
+    var str = posix.cat(filename).wait();
+    var names = [];
+    var parser = new libxml.SaxParser(function(cb) {
+      cb.onStartElementNS(function(elem) {
+        return names.push(elem);
+      });
+    });
+    parser.parseString(str);
+    assertEqual('error,stream,message,body,html,body,prefixed',
+                names.join(','));
+  });
+
+  it('can stop parsing from a callback', function() {
+    var str = posix.cat(filename).wait();
+    var names = [], ended = false;
+    var parser = new libxml.SaxParser(function(cb) {
+      cb.onStartElementNS(function(elem) {
+        names.push(elem);
+        if (elem == 'message')
+          parser.stop();
+      });
+      cb.onEndDocument(function() { ended = true; });
+    });
+    parser.parseString(str);
+    assertEqual('error,stream,message', names.join(','));
+    assertEqual(false, ended);
+  });
+
   it('will properly parse a string chunk by chunk', function() {
     var str_ary = posix.cat(filename).wait().split("\n");
     var parser = createParser('SaxPushParser');
@@ -77,6 +158,82 @@ describe("SAX Push Parser", function() {
     assertEqual(JSON.stringify(control), JSON.stringify(callbacks));
   });
 
+  it('will queue chunks while paused and signal drain', function() {
+    var str_ary = posix.cat(filename).wait().split("\n");
+    var started = 0, drained = 0;
+    var parser = new libxml.SaxPushParser(function(cb) {
+      cb.onStartDocument(function() { started++; });
+      cb.onDrain(function() { drained++; });
+    });
+
+    parser.highWaterMark(16);
+    parser.pause();
+
+    var below_mark = true;
+    for (var i = 0; i < str_ary.length; i++)
+      below_mark = parser.push(str_ary[i], (i+1 == str_ary.length));
+
+    assertEqual(false, below_mark);
+    assertEqual(0, started);
+
+    parser.resume();
+    assertEqual(1, started);
+    assertEqual(1, drained);
+  });
+
+  it('ignores the return value of the drain callback', function() {
+    var names = [];
+    var parser = new libxml.SaxPushParser(function(cb) {
+      cb.onStartElementNS(function(elem) { names.push(elem); });
+      cb.onDrain(function() { return libxml.SaxPushParser.STOP; });
+    });
+
+    parser.highWaterMark(4);
+    parser.pause();
+    parser.push('<message><body/>');
+    parser.resume();
+    parser.push('<footer/></message>', true);
+
+    assertEqual('message,body,footer', names.join(','));
+  });
+
+  it('can parse a series of documents with one push parser', function() {
+    var started = 0, ended = 0, names = [];
+    var parser = new libxml.SaxPushParser(function(cb) {
+      cb.onStartDocument(function() { started++; });
+      cb.onEndDocument(function() { ended++; });
+      cb.onStartElementNS(function(elem) { names.push(elem); });
+    });
+
+    for (var i = 0; i < 3; i++)
+      parser.push('<message id="' + i + '"><body/></message>', true);
+
+    parser.push('<broken><unfinished>');
+    parser.reset();
+    parser.push('<last/>', true);
+
+    assertEqual(5, started);
+    assertEqual(4, ended);
+    assertEqual('message,body,message,body,message,body,broken,unfinished,last',
+                names.join(','));
+  });
+
+  it('can be reset from inside a callback', function() {
+    var names = [];
+    var parser = new libxml.SaxPushParser(function(cb) {
+      cb.onStartElementNS(function(elem) {
+        names.push(elem);
+        if (elem == 'abandon')
+          parser.reset();
+      });
+    });
+
+    parser.push('<abandon><dropped/></abandon>');
+    parser.push('<next><child/></next>', true);
+
+    assertEqual('abandon,next,child', names.join(','));
+  });
+
   it('will properly parse a file', function() {
     var parser = createParser('SaxParser');
     parser.parseFile(filename);
@@ -85,6 +242,57 @@ describe("SAX Push Parser", function() {
     assertEqual(JSON.stringify(control), JSON.stringify(callbacks));
   });
 
+  it('can record the events and replay them later', function() {
+    var log = '/tmp/libxmljs_sax_event_log_' + process.pid;
+    var parser = createParser('SaxParser');
+    parser.record(log);
+    parser.parseFile(filename);
+    parser.record(null);
+
+    callbacks = clone(callbackTest);
+    parser = createParser('SaxParser');
+    parser.replayFile(log);
+    posix.unlink(log).wait();
+
+    assertEqual(JSON.stringify(callbackControl), JSON.stringify(callbacks));
+  });
+
+  it('reports a corrupt event log instead of allocating for it', function() {
+    var log = path.dirname(__filename) + '/fixtures/sax_event_log_corrupt.bin';
+    var parser = createParser('SaxParser');
+    var errors = 0;
+    try { parser.replayFile(log); } catch (e) { errors++; }
+    assertEqual(1, errors);
+  });
+
+  it('reports an event log that could not be written', function() {
+    var parser = createParser('SaxParser');
+    parser.record('/dev/full');
+    var errors = 0;
+    try { parser.parseFile(filename); } catch (e) { errors++; }
+    try { parser.record(null); } catch (e) { errors++; }
+    assertEqual(2, errors);
+  });
+
+  it('can collect parse statistics', function() {
+    var str = posix.cat(filename).wait();
+    var parser = createParser('SaxParser');
+    assertEqual(null, parser.stats());
+
+    parser.stats(true);
+    parser.parseString(str);
+
+    var stats = parser.stats();
+    assertEqual(str.length, stats.bytes);
+    assertEqual(1, stats.events.startDocument);
+    assertEqual(7, stats.events.startElementNS);
+    assertEqual(6, stats.events.endElementNS);
+    assert(stats.characterBytes > 0);
+    assert(stats.callbacks > 0);
+    assert(stats.jsTime > 0);
+    assert(stats.nativeTime > 0);
+  });
+
   it('can can be reused as a string parser', function() {
     var str = posix.cat(filename).wait();
     var parser = createParser('SaxParser');
@@ -23,6 +23,55 @@ describe('Finding a node', function() {
       assertEqual(children[child], results[child]);
   });
 
+  it('returns an Array from #find', function() {
+    var doc = libxml.parseString('<root><child/><child/></root>');
+    var results = doc.find('child');
+    assert(Array.isArray(results));
+    results.push('extra');
+    assertEqual(3, results.length);
+  });
+
+  it('returns a NodeList from #find when asked to be lazy', function() {
+    var doc = new libxml.Document();
+    doc.node('root', function(n) {
+      n.node('child', {id: 'one'});
+      n.node('child', {id: 'two'});
+    });
+    var results = doc.find('child', {lazy: true});
+    assertEqual(false, Array.isArray(results));
+    assertEqual('one', results.item(0).attr('id').value());
+    assertEqual('two', results[1].attr('id').value());
+    assertEqual(null, results.item(2));
+    assertEqual(undefined, results[2]);
+    assertEqual(2, results.toArray().length);
+  });
+
+  it('reads nodes freed after the search as null', function() {
+    var doc = libxml.parseString('<root><child>a</child><child>b</child></root>');
+    var results = doc.find('child', {lazy: true});
+    doc.root().text('replaced');
+    assertEqual(2, results.length);
+    assertEqual(null, results[0]);
+    assertEqual(null, results.item(1));
+  });
+
+  it('reads nodes moved to another document as null', function() {
+    var doc = libxml.parseString('<root><child/><child/></root>');
+    var results = doc.find('child', {lazy: true});
+    var other = new libxml.Document();
+    other.node('other').addChild(results[1]);
+    assertEqual('child', results[0].name());
+    assertEqual(null, results[1]);
+  });
+
+  it('returns an empty result when nothing matches', function() {
+    var doc = new libxml.Document();
+    doc.node('root');
+    assertEqual(0, doc.find('missing').length);
+    assertEqual(0, doc.find('missing', {lazy: true}).length);
+    assertEqual(undefined, doc.get('missing'));
+  });
+
   it('can be nested', function() {
     var grandchild = null;
     var doc = new libxml.Document();
@@ -128,6 +128,10 @@ describe('Document traversal on a parsed document', function() {
     assertEqual(3, doc.children().length);
     for (i = 0; i < children.length; i++)
       assertEqual(children[i], doc.children()[i].name());
+
+    var lazy = doc.children({lazy: true});
+    assertEqual(3, lazy.length);
+    assertEqual('sibling2', lazy[2].name());
   });
 
   it('can traverse siblings', function() {
@@ -144,4 +148,56 @@ describe('Document traversal on a parsed document', function() {
     assertEqual(null, child.prev_sibling().prev_sibling());
     assertEqual(null, child.next_sibling().next_sibling());
   });
+
+  it('can index children from the end', function() {
+    var doc = libxml.parseString(
+      '<?xml version="1.0"?>\
+      <root><first /><middle /><last /></root>\
+    ');
+    assertEqual(3, doc.childCount());
+    assertEqual('last', doc.child(-1).name());
+    assertEqual('first', doc.child(-3).name());
+    assertEqual(null, doc.child(-4));
+    assertEqual(null, doc.child(4));
+  });
+
+  it('keeps the child count current after adding children', function() {
+    var doc = new libxml.Document();
+    var root = doc.node('root');
+    root.node('one');
+    assertEqual(1, root.childCount());
+    root.node('two');
+    assertEqual(2, root.childCount());
+    assertEqual('two', root.child(-1).name());
+  });
+
+  it('rejects child indexes that are not finite', function() {
+    var doc = libxml.parseString('<?xml version="1.0"?><root><a /><b /></root>');
+    var bad = [NaN, Infinity, -Infinity];
+    var thrown = 0;
+    for (var i = 0; i < bad.length; i++) {
+      try { doc.root().child(bad[i]); } catch (e) { thrown++; }
+    }
+    assertEqual(bad.length, thrown);
+    assertEqual(null, doc.root().child(1e30));
+    assertEqual(null, doc.root().child(-1e30));
+  });
+
+  it('truncates fractional child indexes', function() {
+    var doc = libxml.parseString('<?xml version="1.0"?><root><a /><b /></root>');
+    assertEqual('a', doc.root().child(1.5).name());
+    assertEqual('b', doc.root().child(2.9).name());
+    assertEqual('b', doc.root().child(-1.5).name());
+  });
+
+  it('forgets an old parent\'s children when its child becomes a root', function() {
+    var doc = libxml.parseString(
+      '<?xml version="1.0"?><root><a /><b /></root>');
+    var root = doc.root();
+    assertEqual(2, root.childCount());
+    var other = new libxml.Document();
+    other.root(root.child(1));
+    assertEqual(1, root.childCount());
+    assertEqual('b', root.child(1).name());
+  });
 });
@@ -1,7 +1,9 @@
 // Copyright 2009, Squish Tech, LLC.
 #include "./attribute.h"
+#include "./document.h"
 #include "./element.h"
 #include "./namespace.h"
+#include "./xml_string.h"
 
 namespace libxmljs {
 
@@ -10,24 +12,31 @@ v8::Persistent<v8::FunctionTemplate> Attribute::constructor_template;
 v8::Handle<v8::Value>
 Attribute::New(const v8::Arguments& args) {
   v8::HandleScope scope;
-  // was created by BUILD_NODE
-  if (args.Length() == 1 && args[0]->StrictEquals(v8::Null()))
-    return args.This();
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsObject,
+                               "Bad argument: element required");
 
   Element *element = LibXmlObj::Unwrap<Element>(args[0]->ToObject());
+  LIBXMLJS_CHECK_DISPOSED(element);
+  LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
 
   v8::String::Utf8Value name(args[1]->ToString());
   v8::String::Utf8Value value(args[2]->ToString());
 
-  xmlAttr *elem = xmlSetProp(element->xml_obj,
-                             (const xmlChar*)*name,
-                             (const xmlChar*)*value);
+  xmlAttr *elem;
+  {
+    DocumentMemoryScope memory(element->xml_obj->doc);
+    elem = xmlSetProp(element->xml_obj,
+                      (const xmlChar*)*name,
+                      (const xmlChar*)*value);
+  }
 
   // namespace passed in
   if (args.Length() == 4 && args[3]->IsObject()) {
     libxmljs::Namespace *ns = LibXmlObj::Unwrap<libxmljs::Namespace>(
                                 args[3]->ToObject());
     assert(ns);
+    LIBXMLJS_CHECK_DISPOSED(ns);
 
     v8::Persistent<v8::Object> js_attr =
       LIBXMLJS_GET_MAYBE_BUILD(Attribute, xmlAttr, elem);
@@ -43,6 +52,7 @@ Attribute::Name(const v8::Arguments& args) {
   v8::HandleScope scope;
   Attribute *attr = LibXmlObj::Unwrap<Attribute>(args.This());
   assert(attr);
+  LIBXMLJS_CHECK_DISPOSED(attr);
 
   return attr->get_name();
 }
@@ -52,9 +62,11 @@ Attribute::Value(const v8::Arguments& args) {
   v8::HandleScope scope;
   Attribute *attr = LibXmlObj::Unwrap<Attribute>(args.This());
   assert(attr);
+  LIBXMLJS_CHECK_DISPOSED(attr);
 
   // attr.value('new value');
   if (args.Length() > 0) {
+    LIBXMLJS_CHECK_WRITABLE(attr->xml_obj->doc);
     attr->set_value(*v8::String::Utf8Value(args[0]));
     return args.This();
   }
@@ -68,6 +80,7 @@ Attribute::Node(const v8::Arguments& args) {
   v8::HandleScope scope;
   Attribute *attr = LibXmlObj::Unwrap<Attribute>(args.This());
   assert(attr);
+  LIBXMLJS_CHECK_DISPOSED(attr);
 
   return attr->get_element();
 }
@@ -75,8 +88,7 @@ Attribute::Node(const v8::Arguments& args) {
 v8::Handle<v8::Value>
 Attribute::get_name() {
   if (xml_obj->name)
-    return v8::String::New((const char*)xml_obj->name,
-                           xmlStrlen(xml_obj->name));
+    return NewString(xml_obj->name, xmlStrlen(xml_obj->name));
 
   return v8::Null();
 }
@@ -84,18 +96,16 @@ Attribute::get_name() {
 v8::Handle<v8::Value>
 Attribute::get_value() {
   xmlChar* value = xmlNodeGetContent(xml_obj);
-  if (value != NULL) {
-    v8::Handle<v8::String> ret_value = v8::String::New((const char*)value,
-                                                       xmlStrlen(value));
-    xmlFree(value);
-    return ret_value;
-  }
+  if (value != NULL)
+    return AdoptXmlString(value, -1);
 
   return v8::Null();
 }
 
 void
 Attribute::set_value(const char* value) {
+  DocumentMemoryScope memory(xml_obj->doc);
+
   if (xml_obj->children)
     xmlFreeNodeList(xml_obj->children);
 
@@ -126,7 +136,7 @@ Attribute::set_value(const char* value) {
 
 v8::Handle<v8::Value>
 Attribute::get_element() {
-  return JsObj::Unwrap<xmlNode>(xml_obj->parent);
+  return LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, xml_obj->parent);
 }
 
 void
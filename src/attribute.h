@@ -4,6 +4,7 @@
 
 #include "./libxmljs.h"
 #include "./node.h"
+#include "./slab_pool.h"
 
 namespace libxmljs {
 
@@ -13,6 +14,13 @@ class Attribute : public Node {
   explicit Attribute(xmlAttr* node) :
     libxmljs::Node(reinterpret_cast<xmlNode*>(node)) {}
 
+  static void* operator new(size_t size) {
+    return SlabPool<Attribute>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    SlabPool<Attribute>::Free(ptr, size);
+  }
+
   static void Initialize(v8::Handle<v8::Object> target);
   static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
@@ -0,0 +1,44 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./buffer.h"
+
+#include <string.h>
+
+namespace libxmljs {
+
+bool
+IsBuffer(v8::Handle<v8::Value> value) {
+  return value->IsObject() &&
+         value->ToObject()->HasIndexedPropertiesInExternalArrayData();
+}
+
+char*
+BufferData(v8::Handle<v8::Value> buffer) {
+  return static_cast<char*>(
+    buffer->ToObject()->GetIndexedPropertiesExternalArrayData());
+}
+
+size_t
+BufferLength(v8::Handle<v8::Value> buffer) {
+  return buffer->ToObject()->GetIndexedPropertiesExternalArrayDataLength();
+}
+
+v8::Handle<v8::Value>
+NewBuffer(const char* data,
+          size_t length) {
+  v8::HandleScope scope;
+
+  v8::Handle<v8::Value> buffer_ctor =
+    v8::Context::GetCurrent()->Global()->Get(v8::String::NewSymbol("Buffer"));
+
+  if (!buffer_ctor->IsFunction())
+    return scope.Close(v8::String::New(data, length));
+
+  v8::Handle<v8::Value> argv[1] = { v8::Integer::NewFromUnsigned(length) };
+  v8::Handle<v8::Object> buffer =
+    v8::Handle<v8::Function>::Cast(buffer_ctor)->NewInstance(1, argv);
+
+  memcpy(BufferData(buffer), data, length);
+  return scope.Close(buffer);
+}
+
+}  // namespace libxmljs
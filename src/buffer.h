@@ -0,0 +1,30 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_BUFFER_H_
+#define SRC_BUFFER_H_
+
+#include <v8.h>
+
+#include <stddef.h>
+
+namespace libxmljs {
+
+// node.js Buffers keep their bytes outside of the V8 heap, as external array
+// data on the Buffer object.
+bool
+IsBuffer(v8::Handle<v8::Value> value);
+
+char*
+BufferData(v8::Handle<v8::Value> buffer);
+
+size_t
+BufferLength(v8::Handle<v8::Value> buffer);
+
+// Copies data into a new Buffer. Falls back to a string when there is no
+// global Buffer constructor, i.e. outside of node.js.
+v8::Handle<v8::Value>
+NewBuffer(const char* data,
+          size_t length);
+
+}  // namespace libxmljs
+
+#endif  // SRC_BUFFER_H_
@@ -0,0 +1,135 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./builder.h"
+
+#include "./document.h"
+#include "./element.h"
+
+namespace libxmljs {
+
+namespace {
+
+// libxml2's own default limit on element nesting (xmlParserMaxDepth)
+const int kMaxDepth = 256;
+
+}  // namespace
+
+// Returns NULL and sets |error| when |jsonml| is malformed, after freeing
+// whatever was built so far.
+xmlNode*
+Builder::build_element(xmlDoc* doc,
+                       v8::Handle<v8::Array> jsonml,
+                       int depth,
+                       const char** error) {
+  v8::HandleScope scope;
+  uint32_t length = jsonml->Length();
+
+  if (depth > kMaxDepth) {
+    *error = "Bad argument: elements are nested too deeply, or an array "
+             "contains itself";
+    return NULL;
+  }
+
+  if (length == 0 || !jsonml->Get(0)->IsString()) {
+    *error = "Bad argument: an element must start with its name";
+    return NULL;
+  }
+
+  v8::String::Utf8Value name(jsonml->Get(0));
+  xmlNode* node = xmlNewDocNode(doc, NULL, (const xmlChar*)*name, NULL);
+
+  uint32_t i = 1;
+  if (length > 1) {
+    v8::Local<v8::Value> attrs = jsonml->Get(1);
+    if (attrs->IsObject() && !attrs->IsArray()) {
+      Element::set_attrs(node, attrs->ToObject());
+      i = 2;
+    }
+  }
+
+  for (; i < length; i++) {
+    v8::Local<v8::Value> child = jsonml->Get(i);
+
+    if (child->IsArray()) {
+      xmlNode* child_node =
+        build_element(doc, v8::Handle<v8::Array>::Cast(child), depth + 1,
+                      error);
+      if (!child_node) {
+        xmlFreeNode(node);
+        return NULL;
+      }
+      xmlAddChild(node, child_node);
+
+    } else if (child->IsString() || child->IsNumber()) {
+      // merges with a preceding text node
+      v8::String::Utf8Value text(child);
+      xmlNodeAddContentLen(node, (const xmlChar*)*text, text.length());
+
+    } else if (!child->IsNull() && !child->IsUndefined()) {
+      xmlFreeNode(node);
+      *error = "Bad argument: children must be arrays or strings";
+      return NULL;
+    }
+  }
+
+  return node;
+}
+
+v8::Handle<v8::Value>
+Builder::Build(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsObject,
+                               "Bad argument: build(document|element, jsonml)");
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[1],
+                               IsArray,
+                               "Bad argument: build(document|element, jsonml)");
+
+  v8::Handle<v8::Object> target = args[0]->ToObject();
+  v8::Handle<v8::Array> jsonml = v8::Handle<v8::Array>::Cast(args[1]);
+  const char* error = NULL;
+
+  if (Document::constructor_template->HasInstance(target)) {
+    Document *document = LibXmlObj::Unwrap<Document>(target);
+    LIBXMLJS_CHECK_DISPOSED(document);
+    LIBXMLJS_CHECK_WRITABLE(document->xml_obj);
+
+    if (xmlDocGetRootElement(document->xml_obj))
+      return v8::ThrowException(v8::Exception::Error(
+        v8::String::New("This document already has a root node")));
+
+    DocumentMemoryScope memory(document->xml_obj);
+    xmlNode* root = build_element(document->xml_obj, jsonml, 1, &error);
+    if (root)
+      xmlDocSetRootElement(document->xml_obj, root);
+
+  } else if (Element::constructor_template->HasInstance(target)) {
+    Element *element = LibXmlObj::Unwrap<Element>(target);
+    LIBXMLJS_CHECK_DISPOSED(element);
+    LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
+
+    DocumentMemoryScope memory(element->xml_obj->doc);
+    xmlNode* node = build_element(element->xml_obj->doc, jsonml, 1, &error);
+    if (node) {
+      element->invalidate_child_index();
+      xmlAddChild(element->xml_obj, node);
+    }
+
+  } else {
+    return v8::ThrowException(v8::Exception::TypeError(
+      v8::String::New("Bad argument: build(document|element, jsonml)")));
+  }
+
+  if (error)
+    return v8::ThrowException(v8::Exception::TypeError(
+      v8::String::New(error)));
+
+  return args[0];
+}
+
+void
+Builder::Initialize(v8::Handle<v8::Object> target) {
+  v8::HandleScope scope;
+  LIBXMLJS_SET_METHOD(target, "build", Builder::Build);
+}
+
+}  // namespace libxmljs
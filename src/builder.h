@@ -0,0 +1,41 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_BUILDER_H_
+#define SRC_BUILDER_H_
+
+#include <v8.h>
+
+#include <libxml/tree.h>
+
+#include "./libxmljs.h"
+
+namespace libxmljs {
+
+// Builds whole subtrees from JsonML in one native call:
+//
+//   libxml.build(doc, ['feed', {lang: 'en'},
+//                       ['entry', {id: '1'}, 'a'],
+//                       ['entry', {id: '2'}, 'b']]);
+//
+// An element is an array of its name, an optional attribute object and its
+// children; strings (and numbers) become text. With a Document the subtree
+// becomes the root, with an Element it is appended as the last child. No
+// wrappers are created for the new nodes. Nesting is limited to the depth
+// libxml2's parser accepts, which also stops arrays that contain themselves.
+class Builder {
+  public:
+
+  static void Initialize(v8::Handle<v8::Object> target);
+
+  protected:
+
+  static v8::Handle<v8::Value> Build(const v8::Arguments& args);
+
+  static xmlNode* build_element(xmlDoc* doc,
+                                v8::Handle<v8::Array> jsonml,
+                                int depth,
+                                const char** error);
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_BUILDER_H_
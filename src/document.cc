@@ -1,15 +1,106 @@
 // Copyright 2009, Squish Tech, LLC.
 #include "./document.h"
 
+#include <libxml/xmlIO.h>
 #include <libxml/xmlstring.h>
 
+#include <limits.h>
+
+#include <string>
+
+#include "./buffer.h"
 #include "./node.h"
 #include "./element.h"
 #include "./namespace.h"
+#include "./save_options.h"
+#include "./serialize_job.h"
+#include "./xml_string.h"
 
 
 namespace libxmljs {
 
+namespace {
+
+// Output buffer sink that hands the output to a JS callback as Buffers of
+// chunk_size bytes. An exception from the callback stops the save.
+struct ChunkWriter {
+  ChunkWriter(v8::Handle<v8::Function> callback, size_t chunk_size)
+    : callback(callback), chunk_size(chunk_size), failed(false) {
+    pending.reserve(chunk_size);
+  }
+
+  static int
+  write(void* context, const char* data, int len) {
+    ChunkWriter* writer = static_cast<ChunkWriter*>(context);
+    if (writer->failed)
+      return -1;
+
+    for (int written = 0; written < len;) {
+      size_t room = writer->chunk_size - writer->pending.size();
+      size_t count = static_cast<size_t>(len - written);
+      if (count > room)
+        count = room;
+
+      writer->pending.append(data + written, count);
+      written += count;
+
+      if (writer->pending.size() == writer->chunk_size && !writer->flush())
+        return -1;
+    }
+    return len;
+  }
+
+  static int
+  close(void* context) {
+    ChunkWriter* writer = static_cast<ChunkWriter*>(context);
+    if (writer->failed)
+      return -1;
+
+    if (writer->pending.empty() || writer->flush())
+      return 0;
+
+    return -1;
+  }
+
+  bool
+  flush() {
+    v8::HandleScope scope;
+    v8::TryCatch try_catch;
+    v8::Handle<v8::Value> argv[1] = {
+      NewBuffer(pending.data(), pending.size())
+    };
+    pending.clear();
+
+    callback->Call(v8::Context::GetCurrent()->Global(), 1, argv);
+    if (try_catch.HasCaught()) {
+      exception = v8::Persistent<v8::Value>::New(try_catch.Exception());
+      failed = true;
+    }
+    return !failed;
+  }
+
+  v8::Handle<v8::Function> callback;
+  size_t chunk_size;
+  std::string pending;
+  bool failed;
+  v8::Persistent<v8::Value> exception;
+};
+
+// Points the job at a path or a descriptor, false for anything else.
+bool
+set_job_target(SerializeJob* job, v8::Handle<v8::Value> target) {
+  if (target->IsString())
+    job->set_path(*v8::String::Utf8Value(target));
+  else if (target->IsNumber() && target->Int32Value() >= 0)
+    job->set_fd(target->Int32Value());
+  else
+    return false;
+
+  return true;
+}
+
+}  // namespace
+
 v8::Persistent<v8::FunctionTemplate> Document::constructor_template;
 
 v8::Handle<v8::Value>
@@ -23,10 +114,12 @@ Document::Encoding(const v8::Arguments& args) {
   v8::HandleScope scope;
   Document *document = LibXmlObj::Unwrap<Document>(args.This());
   assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
 
   if (args.Length() == 0)
     return document->get_encoding();
 
+  LIBXMLJS_CHECK_WRITABLE(document->xml_obj);
   v8::String::Utf8Value encoding(args[0]->ToString());
   document->set_encoding(*encoding);
   return args.This();
@@ -37,6 +130,7 @@ Document::Version(const v8::Arguments& args) {
   v8::HandleScope scope;
   Document *document = LibXmlObj::Unwrap<Document>(args.This());
   assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
 
   return document->get_version();
 }
@@ -46,16 +140,20 @@ Document::Root(const v8::Arguments& args) {
   v8::HandleScope scope;
   Document *document = LibXmlObj::Unwrap<Document>(args.This());
   assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
 
   if (args.Length() == 0)
     return document->get_root();
 
+  LIBXMLJS_CHECK_WRITABLE(document->xml_obj);
   if (document->has_root())
     return ThrowException(v8::Exception::Error(
       v8::String::New("This document already has a root node")));
 
   Element *element = LibXmlObj::Unwrap<Element>(args[0]->ToObject());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
+  LIBXMLJS_CHECK_MOVABLE(element->xml_obj, document->xml_obj);
   document->set_root(element->xml_obj);
   return args[0];
 }
@@ -65,9 +163,183 @@ Document::ToString(const v8::Arguments& args) {
   v8::HandleScope scope;
   Document *document = LibXmlObj::Unwrap<Document>(args.This());
   assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
   return document->to_string();
 }
 
+v8::Handle<v8::Value>
+Document::Serialize(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
+
+  // serialize(onChunk) or serialize(options, onChunk)
+  int callback_index = args[0]->IsFunction() ? 0 : 1;
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[callback_index], IsFunction,
+                               "Bad argument: must provide a chunk callback");
+
+  SaveOptions options(callback_index ? args[0]
+                                     : v8::Handle<v8::Value>(v8::Undefined()));
+  if (!options.valid_encoding())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unsupported encoding")));
+
+  ChunkWriter writer(v8::Handle<v8::Function>::Cast(args[callback_index]),
+                     options.chunk_size);
+
+  // the callback runs in the middle of the tree walk
+  SerializeScope busy(document);
+
+  xmlCharEncodingHandler* encoder = options.encoder();
+  xmlOutputBuffer* output = xmlOutputBufferCreateIO(ChunkWriter::write,
+                                                    ChunkWriter::close,
+                                                    &writer,
+                                                    encoder);
+  if (!output) {
+    if (encoder)
+      xmlCharEncCloseFunc(encoder);
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to create serializer")));
+  }
+
+  int result = SerializeJob::Write(document->xml_obj, options, output);
+  if (xmlOutputBufferClose(output) < 0)
+    result = -1;
+
+  if (writer.failed) {
+    v8::Handle<v8::Value> exception = v8::Local<v8::Value>::New(
+      writer.exception);
+    writer.exception.Dispose();
+    return v8::ThrowException(exception);
+  }
+
+  if (result < 0)
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to serialize document")));
+
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+Document::SaveFile(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
+
+  // saveFile(path, [options]) or saveFile(fd, [options])
+  SaveOptions options(args[1]);
+  if (!options.valid_encoding())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unsupported encoding")));
+
+  SerializeJob job(document->xml_obj, options);
+  if (!set_job_target(&job, args[0]))
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Bad argument: must provide a path or a fd")));
+
+  job.run();
+  if (job.error())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New(job.error())));
+
+  return scope.Close(v8::Integer::New(job.written()));
+}
+
+// _serializeStart(options, [path|fd]) serializes on a thread of its own and
+// returns an id for _serializeResult. The document is read-only until every
+// started job has had its result collected.
+v8::Handle<v8::Value>
+Document::SerializeStart(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+  LIBXMLJS_CHECK_DISPOSED(document);
+
+  SaveOptions options(args[0]);
+  if (!options.valid_encoding())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unsupported encoding")));
+
+  SerializeJob* job = new SerializeJob(document->xml_obj, options);
+  if (args.Length() > 1 && !set_job_target(job, args[1])) {
+    delete job;
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Bad argument: must provide a path or a fd")));
+  }
+
+  if (!job->start()) {
+    delete job;
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to start serializer thread")));
+  }
+
+  // the wrapper must outlive the thread walking its tree
+  if (document->jobs_.empty())
+    document->busy_handle_ = v8::Persistent<v8::Object>::New(args.This());
+
+  static int next_id = 0;
+  int id = ++next_id;
+  document->jobs_[id] = job;
+
+  return scope.Close(v8::Integer::New(id));
+}
+
+// _serializeResult(id) returns undefined while the job is running, then its
+// output as a Buffer, or the bytes written for a file. Failures throw.
+v8::Handle<v8::Value>
+Document::SerializeResult(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+
+  std::map<int, SerializeJob*>::iterator it =
+    document->jobs_.find(args[0]->Int32Value());
+  if (it == document->jobs_.end())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unknown serializer job")));
+
+  SerializeJob* job = it->second;
+  if (!job->done())
+    return v8::Undefined();
+
+  document->jobs_.erase(it);
+  if (document->jobs_.empty())
+    document->busy_handle_.Dispose();
+
+  v8::Handle<v8::Value> result;
+  if (job->error())
+    result = v8::ThrowException(v8::Exception::Error(
+      v8::String::New(job->error())));
+  else if (job->has_target())
+    result = v8::Integer::New(job->written());
+  else
+    result = NewBuffer(job->output().data(), job->output().size());
+
+  delete job;
+  return scope.Close(result);
+}
+
+v8::Handle<v8::Value>
+Document::Dispose(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+  LIBXMLJS_CHECK_WRITABLE(document->xml_obj);
+
+  document->dispose();
+  return v8::Undefined();
+}
+
+v8::Handle<v8::Value>
+Document::MemoryUsage(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Document *document = LibXmlObj::Unwrap<Document>(args.This());
+  assert(document);
+
+  return scope.Close(v8::Number::New(document->native_bytes_));
+}
 
 v8::Handle<v8::Value>
 Document::New(const v8::Arguments& args) {
@@ -81,10 +353,6 @@ Document::New(const v8::Arguments& args) {
       break;
 
     case 1:  // newDocument(version), newDocument(callback)
-      // was created by BUILD_NODE
-      if (args[0]->StrictEquals(v8::Null()))
-        return args.This();
-
       if (args[0]->IsString()) {
         version = new v8::String::Utf8Value(args[0]->ToString());
 
@@ -128,10 +396,12 @@ Document::New(const v8::Arguments& args) {
   if (!version)
     version = new v8::String::Utf8Value(v8::String::New("1.0"));
 
+  MemoryCounter counter;
   xmlDoc* doc = xmlNewDoc((const xmlChar*)**version);
   v8::Persistent<v8::Object> obj =
     LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, doc);
   Document *document = LibXmlObj::Unwrap<Document>(obj);
+  document->adjust_native_bytes(counter.bytes());
 
   if (encoding)
     document->set_encoding(**encoding);
@@ -144,21 +414,209 @@ Document::New(const v8::Arguments& args) {
   return obj;
 }
 
+Document::Document(xmlDoc* document)
+  : xml_obj(document), arena_(NULL), native_bytes_(0), serializing_(0),
+    freed_log_(new FreedNodeLog()) {
+  xml_obj->_private = static_cast<LibXmlObj*>(this);
+}
+
 Document::~Document() {
-  xmlFreeDoc(xml_obj);
+  // busy_handle_ keeps the wrapper alive while jobs run, but a job whose
+  // result was never collected must not outlive the tree it reads
+  for (std::map<int, SerializeJob*>::iterator it = jobs_.begin();
+       it != jobs_.end(); ++it)
+    delete it->second;  // waits for it
+  jobs_.clear();
+
+  dispose();
+  freed_log_->unref();
+}
+
+void
+Document::dispose() {
+  // on_libxml_destruct detaches their wrappers too
+  std::set<xmlNode*> detached;
+  detached.swap(detached_);
+  for (std::set<xmlNode*>::iterator it = detached.begin();
+       it != detached.end(); ++it)
+    xmlFreeNode(*it);
+
+  // xml_obj is cleared by on_libxml_destruct if libxml freed it first, and
+  // by an earlier dispose()
+  if (xml_obj) {
+    // cleared first so NodeFreed doesn't log every node, lists of a
+    // disposed document can't be read anyway
+    xmlDoc* doc = xml_obj;
+    xml_obj = NULL;
+
+    // on_libxml_destruct detaches the wrappers of the nodes as they go
+    xmlFreeDoc(doc);
+  }
+
+  // frees inside xmlFreeDoc are no-ops for arena blocks, they go here
+  delete arena_;
+  arena_ = NULL;
+
+  adjust_native_bytes(-native_bytes_);
+}
+
+void
+Document::adjust_native_bytes(ptrdiff_t delta) {
+  if (native_bytes_ + delta < 0)
+    delta = -native_bytes_;
+
+  native_bytes_ += delta;
+
+  // V8 takes the change as an int
+  while (delta != 0) {
+    int step = delta > INT_MAX ? INT_MAX : delta < -INT_MAX ? -INT_MAX : delta;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(step);
+    delta -= step;
+  }
+}
+
+void
+Document::TrackDetached(xmlNode* node) {
+  if (node->doc && node->doc->_private)
+    static_cast<Document*>(static_cast<LibXmlObj*>(node->doc->_private))
+      ->detached_.insert(node);
+}
+
+void
+Document::UntrackDetached(xmlNode* node) {
+  if (node->doc && node->doc->_private)
+    static_cast<Document*>(static_cast<LibXmlObj*>(node->doc->_private))
+      ->detached_.erase(node);
+}
+
+namespace {
+
+size_t
+string_bytes(xmlDoc* doc, const xmlChar* str) {
+  // dictionary strings stay behind with the old document
+  if (!str || (doc && doc->dict && xmlDictOwns(doc->dict, str)))
+    return 0;
+  return BlockSize(str);
+}
+
+// libxml2 memory held by node and everything under it
+size_t
+node_bytes(xmlNode* node) {
+  xmlDoc* doc = node->doc;
+  size_t bytes = BlockSize(node) + string_bytes(doc, node->name);
+
+  if (node->type == XML_ELEMENT_NODE) {
+    for (xmlAttr* attr = node->properties; attr; attr = attr->next) {
+      bytes += BlockSize(attr) + string_bytes(doc, attr->name);
+      for (xmlNode* child = attr->children; child; child = child->next)
+        bytes += node_bytes(child);
+    }
+    for (xmlNs* ns = node->nsDef; ns; ns = ns->next)
+      bytes += BlockSize(ns) + BlockSize(ns->href) + BlockSize(ns->prefix);
+  } else if (node->content != reinterpret_cast<xmlChar*>(&node->properties)) {
+    bytes += string_bytes(doc, node->content);
+  }
+
+  for (xmlNode* child = node->children; child; child = child->next)
+    bytes += node_bytes(child);
+
+  return bytes;
+}
+
+// Records node and everything under it as gone from its document.
+void
+log_subtree(FreedNodeLog* log, xmlNode* node) {
+  log->add(node);
+
+  if (node->type == XML_ELEMENT_NODE) {
+    for (xmlAttr* attr = node->properties; attr; attr = attr->next)
+      log_subtree(log, reinterpret_cast<xmlNode*>(attr));
+  }
+
+  for (xmlNode* child = node->children; child; child = child->next)
+    log_subtree(log, child);
+}
+
+Document*
+document_of(xmlDoc* doc) {
+  if (!doc || !doc->_private)
+    return NULL;
+  return static_cast<Document*>(static_cast<LibXmlObj*>(doc->_private));
+}
+
+}  // namespace
+
+void
+Document::TransferNode(xmlNode* node, xmlDoc* target) {
+  if (node->doc == target)
+    return;
+
+  Document* from = document_of(node->doc);
+  Document* to = document_of(target);
+  if (!from && !to)
+    return;
+
+  // lists taken from the old document read these nodes as null from now on
+  if (from && from->freed_log_->listening())
+    log_subtree(from->freed_log_, node);
+
+  ptrdiff_t bytes = node_bytes(node);
+  if (from)
+    from->adjust_native_bytes(-bytes);
+  if (to)
+    to->adjust_native_bytes(bytes);
+}
+
+bool
+Document::HasArena(xmlDoc* doc) {
+  if (!doc || !doc->_private)
+    return false;
+
+  return static_cast<Document*>(static_cast<LibXmlObj*>(doc->_private))
+    ->arena_ != NULL;
+}
+
+void
+Document::NodeFreed(xmlNode* node) {
+  if (!node->doc || !node->doc->_private)
+    return;
+
+  Document* document =
+    static_cast<Document*>(static_cast<LibXmlObj*>(node->doc->_private));
+  if (document->xml_obj)
+    document->freed_log_->add(node);
+}
+
+bool
+Document::IsReadOnly(xmlDoc* doc) {
+  if (!doc || !doc->_private)
+    return false;
+
+  Document* document =
+    static_cast<Document*>(static_cast<LibXmlObj*>(doc->_private));
+  return !document->jobs_.empty() || document->serializing_ > 0;
+}
+
+DocumentMemoryScope::~DocumentMemoryScope() {
+  if (doc_ && doc_->_private)
+    static_cast<Document*>(static_cast<LibXmlObj*>(doc_->_private))
+      ->adjust_native_bytes(counter_.bytes());
 }
 
 void
 Document::set_encoding(const char* encoding) {
-  xml_obj->encoding = (const xmlChar*)encoding;
+  DocumentMemoryScope memory(xml_obj);
+
+  if (xml_obj->encoding)
+    xmlFree(const_cast<xmlChar*>(xml_obj->encoding));
+  xml_obj->encoding = xmlStrdup((const xmlChar*)encoding);
 }
 
 v8::Handle<v8::Value>
 Document::get_encoding() {
   v8::HandleScope scope;
   if (xml_obj->encoding)
-    return v8::String::New((const char *)xml_obj->encoding,
-                           xmlStrlen((const xmlChar*)xml_obj->encoding));
+    return NewString(xml_obj->encoding, xmlStrlen(xml_obj->encoding));
 
   return v8::Null();
 }
@@ -167,8 +625,7 @@ v8::Handle<v8::Value>
 Document::get_version() {
   v8::HandleScope scope;
   if (xml_obj->version)
-    return v8::String::New((const char *)xml_obj->version,
-                           xmlStrlen((const xmlChar*)xml_obj->version));
+    return NewString(xml_obj->version, xmlStrlen(xml_obj->version));
 
   return v8::Null();
 }
@@ -176,14 +633,10 @@ Document::get_version() {
 v8::Handle<v8::Value>
 Document::to_string() {
   v8::HandleScope scope;
-  xmlChar* buffer = NULL;
-  int len = 0;
-
-  xmlDocDumpFormatMemoryEnc(xml_obj, &buffer, &len, "UTF-8", 0);
-  v8::Local<v8::String> str = v8::String::New((const char*)buffer, len);
-  xmlFree(buffer);
+  SerializeJob job(xml_obj, SaveOptions(v8::Undefined()));
+  job.run();
 
-  return str;
+  return scope.Close(NewString(job.output().data(), job.output().size()));
 }
 
 bool
@@ -203,6 +656,12 @@ Document::get_root() {
 
 void
 Document::set_root(xmlNodePtr node) {
+  // the new root leaves its old parent, whose child index is now stale
+  Element::ChildrenChanged(node->parent);
+  UntrackDetached(node);
+  TransferNode(node, xml_obj);
+
+  DocumentMemoryScope memory(xml_obj);
   xmlDocSetRootElement(xml_obj, node);
 }
 
@@ -222,6 +681,30 @@ Document::Initialize(v8::Handle<v8::Object> target) {
                         "toString",
                         Document::ToString);
 
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "serialize",
+                        Document::Serialize);
+
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "saveFile",
+                        Document::SaveFile);
+
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "_serializeStart",
+                        Document::SerializeStart);
+
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "_serializeResult",
+                        Document::SerializeResult);
+
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "memoryUsage",
+                        Document::MemoryUsage);
+
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "dispose",
+                        Document::Dispose);
+
   target->Set(v8::String::NewSymbol("Document"),
               constructor_template->GetFunction());
 
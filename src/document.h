@@ -2,19 +2,104 @@
 #ifndef SRC_DOCUMENT_H_
 #define SRC_DOCUMENT_H_
 
+#include <map>
+#include <set>
+#include <vector>
+
 #include "./libxmljs.h"
+#include "./memory.h"
 #include "./object_wrap.h"
+#include "./slab_pool.h"
 
 namespace libxmljs {
 
+class SerializeJob;
+
+// The nodes libxml2 freed out of one document, or that moved to another
+// one, shared by the document and the NodeLists taken from it so a list can
+// tell which of its pointers went stale. Nothing is recorded unless a list
+// holds a reference.
+class FreedNodeLog {
+  public:
+
+  FreedNodeLog() : refs_(1) {}
+
+  void ref() { ++refs_; }
+  void unref() {
+    if (--refs_ == 0)
+      delete this;
+    else if (refs_ == 1)
+      nodes_.clear();  // nobody left to read it
+  }
+
+  // True while a list holds the log.
+  bool listening() const { return refs_ > 1; }
+
+  void add(xmlNode* node) {
+    if (listening())
+      nodes_.push_back(node);
+  }
+
+  // Position after the last recorded free, for freed_since().
+  size_t position() const { return nodes_.size(); }
+
+  // The nodes freed since |position|.
+  std::vector<xmlNode*> freed_since(size_t position) const {
+    return std::vector<xmlNode*>(nodes_.begin() + position, nodes_.end());
+  }
+
+  private:
+
+  int refs_;
+  std::vector<xmlNode*> nodes_;
+};
+
 class Document : public LibXmlObj {
   public:
 
   xmlDoc* xml_obj;
-  explicit Document(xmlDoc* document) : xml_obj(document) {}
+  explicit Document(xmlDoc* document);
+
+  static void* operator new(size_t size) {
+    return SlabPool<Document>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    SlabPool<Document>::Free(ptr, size);
+  }
+
   static void Initialize(v8::Handle<v8::Object> target);
   static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
+  // Takes ownership of the arena the document was parsed into.
+  void set_arena(Arena* arena) { arena_ = arena; }
+
+  // Records a change in the native memory behind the document and passes it
+  // on to V8, so large documents put pressure on the GC.
+  void adjust_native_bytes(ptrdiff_t delta);
+
+  // Nodes created for a document but not in its tree yet. dispose() frees
+  // them with the document, as they point into it. Untrack a node before
+  // attaching it anywhere.
+  static void TrackDetached(xmlNode* node);
+  static void UntrackDetached(xmlNode* node);
+
+  // Moves the charge for |node| and its subtree from the document it is in
+  // to |target|. Call before linking the node into |target|.
+  static void TransferNode(xmlNode* node, xmlDoc* target);
+
+  // True when |doc| was parsed into an arena. Its nodes live in the arena
+  // and can't move to another document.
+  static bool HasArena(xmlDoc* doc);
+
+  // Records a node libxml2 is freeing in the log of its document.
+  static void NodeFreed(xmlNode* node);
+
+  FreedNodeLog* freed_log() { return freed_log_; }
+
+  // True while |doc| is being serialized, on a thread or with a chunk
+  // callback that could otherwise change the tree under the serializer.
+  static bool IsReadOnly(xmlDoc* doc);
+
   protected:
 
   static v8::Handle<v8::Value> New(const v8::Arguments& args);
@@ -23,9 +108,20 @@ class Document : public LibXmlObj {
   static v8::Handle<v8::Value> Version(const v8::Arguments& args);
   static v8::Handle<v8::Value> Doc(const v8::Arguments& args);
   static v8::Handle<v8::Value> ToString(const v8::Arguments& args);
+  static v8::Handle<v8::Value> Serialize(const v8::Arguments& args);
+  static v8::Handle<v8::Value> SaveFile(const v8::Arguments& args);
+  static v8::Handle<v8::Value> SerializeStart(const v8::Arguments& args);
+  static v8::Handle<v8::Value> SerializeResult(const v8::Arguments& args);
+  static v8::Handle<v8::Value> MemoryUsage(const v8::Arguments& args);
+  static v8::Handle<v8::Value> Dispose(const v8::Arguments& args);
 
   virtual ~Document();
 
+  // Frees the document now instead of when the wrapper is collected, along
+  // with the nodes created for it outside the tree. Every wrapper of those
+  // is detached, so using it afterwards throws.
+  void dispose();
+
   void init_document(const char* version);
   void set_encoding(const char* encoding);
   v8::Handle<v8::Value> get_encoding();
@@ -34,6 +130,63 @@ class Document : public LibXmlObj {
   v8::Handle<v8::Value> get_root();
   void set_root(xmlNodePtr node);
   bool has_root();
+
+  Arena* arena_;
+  ptrdiff_t native_bytes_;
+
+  // running serializations by id, and a handle keeping the wrapper alive
+  // while there are any
+  std::map<int, SerializeJob*> jobs_;
+  v8::Persistent<v8::Object> busy_handle_;
+
+  // serialize() calls in progress on this thread
+  int serializing_;
+
+  std::set<xmlNode*> detached_;
+  FreedNodeLog* freed_log_;
+
+  friend class SerializeScope;
+};
+
+// Keeps the document read-only while in scope.
+class SerializeScope {
+  public:
+
+  explicit SerializeScope(Document* document) : document_(document) {
+    ++document_->serializing_;
+  }
+  ~SerializeScope() { --document_->serializing_; }
+
+  private:
+
+  Document* document_;
+};
+
+// Arena nodes can't leave their document, their memory goes with its arena.
+#define LIBXMLJS_CHECK_MOVABLE(node, target)                                  \
+  if ((node)->doc != (target) && Document::HasArena((node)->doc))             \
+    return v8::ThrowException(v8::Exception::Error(                           \
+      v8::String::New("Nodes of an arena document can't move to another "     \
+                      "document")));
+
+// Mutators check this first, the tree is being read by a serializer.
+#define LIBXMLJS_CHECK_WRITABLE(doc)                                          \
+  if (Document::IsReadOnly(doc))                                              \
+    return v8::ThrowException(v8::Exception::Error(                           \
+      v8::String::New("The document is read-only while it is serialized")));
+
+// Charges the libxml2 memory allocated on this thread while in scope to the
+// wrapper of |doc|, if it has one.
+class DocumentMemoryScope {
+  public:
+
+  explicit DocumentMemoryScope(xmlDoc* doc) : doc_(doc) {}
+  ~DocumentMemoryScope();
+
+  private:
+
+  xmlDoc* doc_;
+  MemoryCounter counter_;
 };
 
 }  // namespace libxmljs
@@ -7,8 +7,8 @@ libxml.Document.prototype.find = function() {
   return this.root().find.apply(this.root(), arguments);
 };
 
-libxml.Document.prototype.get = function() {
-  return this.find.apply(this, arguments)[0];
+libxml.Document.prototype.get = function(xpath) {
+  return this.root().get(xpath);
 };
 
 libxml.Document.prototype.child = function() {
@@ -16,5 +16,56 @@ libxml.Document.prototype.child = function() {
 };
 
 libxml.Document.prototype.children = function() {
-  return this.root().children();
+  return this.root().children.apply(this.root(), arguments);
+};
+
+libxml.Document.prototype.childCount = function() {
+  return this.root().childCount();
+};
+
+libxml.Document.prototype.toObject = function() {
+  return this.root().toObject.apply(this.root(), arguments);
+};
+
+// Serializes on the native worker pool and polls for the result, backing
+// off so a long job doesn't keep the event loop spinning. The document is
+// read-only until the callback runs.
+libxml.Document.prototype._serializeAsync = function(job, callback) {
+  var doc = this;
+  var delay = 1;
+  var poll = function() {
+    var result;
+    try {
+      result = doc._serializeResult(job);
+    } catch (e) {
+      return callback(e);
+    }
+
+    if (result === undefined) {
+      delay = Math.min(delay * 2, 16);
+      return libxml._defer(poll, delay);
+    }
+
+    callback(null, result);
+  };
+  libxml._defer(poll, delay);
+};
+
+// doc.toStringAsync([options], callback) calls back with a Buffer.
+libxml.Document.prototype.toStringAsync = function(options, callback) {
+  if (typeof options == 'function') {
+    callback = options;
+    options = null;
+  }
+  this._serializeAsync(this._serializeStart(options), callback);
+};
+
+// doc.saveFileAsync(path|fd, [options], callback) calls back with the bytes
+// written.
+libxml.Document.prototype.saveFileAsync = function(target, options, callback) {
+  if (typeof options == 'function') {
+    callback = options;
+    options = null;
+  }
+  this._serializeAsync(this._serializeStart(options, target), callback);
 };
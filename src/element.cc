@@ -1,28 +1,241 @@
 // Copyright 2009, Squish Tech, LLC.
 #include "./element.h"
 
+#include <libxml/entities.h>
+#include <libxml/xmlsave.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 
+#include <math.h>
+#include <string.h>
+
+#include <string>
+
+#include "./buffer.h"
 #include "./document.h"
 #include "./attribute.h"
+#include "./node_list.h"
+#include "./save_options.h"
+#include "./xml_string.h"
 
 namespace libxmljs {
 
 #define NAME_SYMBOL     v8::String::NewSymbol("name")
 #define CONTENT_SYMBOL  v8::String::NewSymbol("content")
+#define ATTRS_SYMBOL    v8::String::NewSymbol("attrs")
+#define CHILDREN_SYMBOL v8::String::NewSymbol("children")
 
 v8::Persistent<v8::FunctionTemplate> Element::constructor_template;
 
+namespace {
+
+// Scratch buffer for toString(), kept between calls so dumping a small
+// subtree allocates nothing. Only touched on the JS thread.
+xmlBuffer* dump_buffer = NULL;
+
+// larger scratch buffers are freed after use rather than kept around
+const unsigned int kMaxDumpBufferSize = 1024 * 1024;
+
+// Dumps node and its subtree into dump_buffer, converted to the requested
+// encoding. Returns NULL on failure.
+xmlBuffer*
+dump_node(xmlNode* node, const SaveOptions& options) {
+  if (!dump_buffer) {
+    dump_buffer = xmlBufferCreateSize(4096);
+    xmlBufferSetAllocationScheme(dump_buffer, XML_BUFFER_ALLOC_DOUBLEIT);
+  } else {
+    xmlBufferEmpty(dump_buffer);
+  }
+
+  const char* encoding = options.encoding_name();
+  if (!encoding) {
+    if (xmlNodeDump(dump_buffer, node->doc, node, 0, options.format) < 0)
+      return NULL;
+    return dump_buffer;
+  }
+
+  xmlCharEncodingHandler* handler = xmlFindCharEncodingHandler(encoding);
+  if (!handler)
+    return NULL;
+
+  // writes into dump_buffer and leaves it allocated when closed; closing
+  // the output buffer also closes the handler
+  xmlOutputBuffer* output = xmlOutputBufferCreateBuffer(dump_buffer, handler);
+  if (!output) {
+    xmlCharEncCloseFunc(handler);
+    return NULL;
+  }
+
+  xmlNodeDumpOutput(output, node->doc, node, 0, options.format, encoding);
+  if (xmlOutputBufferClose(output) < 0)
+    return NULL;
+
+  return dump_buffer;
+}
+
+void
+release_dump_buffer() {
+  if (dump_buffer && dump_buffer->size > kMaxDumpBufferSize) {
+    xmlBufferFree(dump_buffer);
+    dump_buffer = NULL;
+  }
+}
+
+// Options for toObject(), see Element::ToObject.
+struct ObjectOptions {
+  bool coalesce;
+  std::string attr_prefix;
+};
+
+// [prefix][ns:]name
+v8::Handle<v8::String>
+qualified_name(const xmlChar* name,
+               xmlNs* ns,
+               const std::string& prefix = std::string()) {
+  if ((!ns || !ns->prefix) && prefix.empty())
+    return NewString(name);
+
+  std::string qualified(prefix);
+  if (ns && ns->prefix) {
+    qualified += (const char*)ns->prefix;
+    qualified += ':';
+  }
+  qualified += (const char*)name;
+  return NewString(qualified.data(), qualified.size());
+}
+
+// Reads the value straight off the common single text child instead of
+// going through xmlNodeGetContent.
+v8::Handle<v8::String>
+attr_value(xmlAttr* attr) {
+  xmlNode* child = attr->children;
+  if (!child)
+    return v8::String::New("");
+
+  if (!child->next && child->type == XML_TEXT_NODE)
+    return NewString(child->content);
+
+  xmlChar* value = xmlNodeListGetString(attr->doc, child, 1);
+  v8::Handle<v8::String> str = NewString(value);
+  xmlFree(value);
+  return str;
+}
+
+// Sets prefix + name = value on |target| for every attribute in the list.
+void
+set_attr_values(v8::Handle<v8::Object> target,
+                xmlAttr* attr,
+                const std::string& prefix,
+                bool qualified) {
+  for (; attr; attr = attr->next) {
+    target->Set(qualified_name(attr->name, qualified ? attr->ns : NULL, prefix),
+                attr_value(attr));
+  }
+}
+
+v8::Handle<v8::Object>
+element_object(xmlNode* node,
+               const ObjectOptions& options) {
+  v8::HandleScope scope;
+  v8::Local<v8::Object> obj = v8::Object::New();
+  obj->Set(NAME_SYMBOL, qualified_name(node->name, node->ns));
+
+  if (options.attr_prefix.empty()) {
+    v8::Local<v8::Object> attrs = v8::Object::New();
+    set_attr_values(attrs, node->properties, options.attr_prefix, true);
+    obj->Set(ATTRS_SYMBOL, attrs);
+  } else {
+    set_attr_values(obj, node->properties, options.attr_prefix, true);
+  }
+
+  v8::Local<v8::Array> children = v8::Array::New();
+  uint32_t count = 0;
+  std::string text;
+  bool has_text = false;
+
+  // entity references are expanded in place; these are the nodes to resume
+  // from once an entity's content runs out
+  std::vector<xmlNode*> resume;
+  xmlNode* child = node->children;
+
+  while (child || !resume.empty()) {
+    if (!child) {
+      child = resume.back();
+      resume.pop_back();
+      continue;
+    }
+
+    switch (child->type) {
+      case XML_ELEMENT_NODE:
+        if (has_text) {
+          children->Set(count++, NewString(text.data(), text.size()));
+          text.clear();
+          has_text = false;
+        }
+        children->Set(count++, element_object(child, options));
+        break;
+
+      case XML_TEXT_NODE:
+      case XML_CDATA_SECTION_NODE:
+        if (options.coalesce) {
+          text += (const char*)child->content;
+          has_text = true;
+        } else {
+          children->Set(count++,
+                        NewString(child->content));
+        }
+        break;
+
+      case XML_ENTITY_REF_NODE: {
+        // the parser keeps the entity's replacement content on its
+        // declaration; external entities that were never loaded have none
+        xmlEntity* entity = xmlGetDocEntity(child->doc, child->name);
+        if (entity && entity->children) {
+          resume.push_back(child->next);
+          child = entity->children;
+          continue;
+        }
+        break;
+      }
+
+      default:  // comments and processing instructions are left out
+        break;
+    }
+
+    child = child->next;
+  }
+
+  if (has_text)
+    children->Set(count++, NewString(text.data(), text.size()));
+
+  obj->Set(CHILDREN_SYMBOL, children);
+  return scope.Close(obj);
+}
+
+// children() and find() return a plain Array unless the options ask for a
+// lazy NodeList with {lazy: true}.
+bool
+lazy_option(v8::Handle<v8::Value> options) {
+  if (!options->IsObject())
+    return false;
+
+  return options->ToObject()->Get(v8::String::NewSymbol("lazy"))
+    ->BooleanValue();
+}
+
+}  // namespace
+
 // doc, name, attrs, content, callback
 v8::Handle<v8::Value>
 Element::New(const v8::Arguments& args) {
   v8::HandleScope scope;
-  // was created by BUILD_NODE
-  if (args.Length() == 0 || args[0]->StrictEquals(v8::Null()))
-    return args.This();
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsObject,
+                               "Bad argument: document required");
 
   Document *document = LibXmlObj::Unwrap<Document>(args[0]->ToObject());
+  LIBXMLJS_CHECK_DISPOSED(document);
+  LIBXMLJS_CHECK_WRITABLE(document->xml_obj);
   v8::String::Utf8Value name(args[1]);
 
   v8::String::Utf8Value *content = NULL;
@@ -34,26 +247,23 @@ Element::New(const v8::Arguments& args) {
   if (args[4]->IsFunction())
     callback = v8::Handle<v8::Function>::Cast(args[4]);
 
-  xmlNode* elem = xmlNewDocNode(document->xml_obj,
-                                NULL,
-                                (const xmlChar*)*name,
-                                content ? (const xmlChar*)**content : NULL);
+  xmlNode* elem;
+  {
+    DocumentMemoryScope memory(document->xml_obj);
+    elem = xmlNewDocNode(document->xml_obj,
+                         NULL,
+                         (const xmlChar*)*name,
+                         content ? (const xmlChar*)**content : NULL);
+  }
+
+  Document::TrackDetached(elem);
 
   v8::Persistent<v8::Object> obj =
     LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, elem);
   Element *element = LibXmlObj::Unwrap<Element>(obj);
 
-  if (args[2]->IsObject()) {
-    v8::Handle<v8::Object> attributes = args[2]->ToObject();
-    v8::Handle<v8::Array> props = attributes->GetPropertyNames();
-    for (unsigned int i = 0; i < props->Length(); i++) {
-      v8::String::Utf8Value name(
-        props->Get(v8::Number::New(i)));
-      v8::String::Utf8Value value(
-        attributes->Get(props->Get(v8::Number::New(i))));
-      element->set_attr(*name, *value);
-    }
-  }
+  if (args[2]->IsObject())
+    element->set_attrs(args[2]->ToObject());
 
   obj->Set(v8::String::NewSymbol("document"), args[0]->ToObject());
 
@@ -70,10 +280,12 @@ Element::Name(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   if (args.Length() == 0)
     return element->get_name();
 
+  LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
   v8::String::Utf8Value name(args[0]->ToString());
   element->set_name(*name);
   return args.This();
@@ -84,6 +296,7 @@ Element::Attr(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   v8::Handle<v8::Object> attrs;
 
@@ -106,15 +319,8 @@ Element::Attr(const v8::Arguments& args) {
         "Bad argument(s): #attr(name) or #attr({name: value})");
   }
 
-  v8::Handle<v8::Array> properties = attrs->GetPropertyNames();
-  for (unsigned int i = 0; i < properties->Length(); i++) {
-    v8::Local<v8::String> prop_name = properties->Get(
-      v8::Number::New(i))->ToString();
-    v8::String::Utf8Value name(prop_name);
-    v8::String::Utf8Value value(attrs->Get(prop_name));
-    element->set_attr(*name, *value);
-  }
-
+  LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
+  element->set_attrs(attrs);
   return args.This();
 }
 
@@ -123,18 +329,39 @@ Element::Attrs(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   return element->get_attrs();
 }
 
+// element.attrsObject({qualified: false}) returns {name: value} for every
+// attribute. With qualified the keys carry the namespace prefix (xml:lang).
+v8::Handle<v8::Value>
+Element::AttrsObject(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Element *element = LibXmlObj::Unwrap<Element>(args.This());
+  assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
+
+  bool qualified = args[0]->IsObject() &&
+    args[0]->ToObject()->Get(v8::String::NewSymbol("qualified"))->BooleanValue();
+
+  return scope.Close(element->get_attrs_object(qualified));
+}
+
 v8::Handle<v8::Value>
 Element::AddChild(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   Element *child = LibXmlObj::Unwrap<Element>(args[0]->ToObject());
   assert(child);
+  LIBXMLJS_CHECK_DISPOSED(child);
+  LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
+  LIBXMLJS_CHECK_WRITABLE(child->xml_obj->doc);
+  LIBXMLJS_CHECK_MOVABLE(child->xml_obj, element->xml_obj->doc);
 
   element->add_child(child);
   return args.This();
@@ -145,9 +372,10 @@ Element::Find(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   v8::String::Utf8Value xpath(args[0]);
-  return element->find(*xpath);
+  return element->find(*xpath, lazy_option(args[1]));
 }
 
 v8::Handle<v8::Value>
@@ -155,11 +383,13 @@ Element::Text(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   if (args.Length() == 0) {
     return element->get_content();
 
   } else {
+    LIBXMLJS_CHECK_WRITABLE(element->xml_obj->doc);
     element->set_content(*v8::String::Utf8Value(args[0]));
   }
 
@@ -171,17 +401,24 @@ Element::Child(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   double idx = 1;
 
   if (args.Length() > 0) {
-    if (!args[0]->IsNumber()) {
-      LIBXMLJS_THROW_EXCEPTION(
-        "Bad argument: must provide #child() with a number");
-
-    } else {
-      idx = args[0]->ToNumber()->Value();
-    }
+    if (!args[0]->IsNumber())
+      return v8::ThrowException(v8::Exception::Error(v8::String::New(
+        "Bad argument: must provide #child() with a number")));
+
+    idx = args[0]->ToNumber()->Value();
+    // rejects NaN and the infinities
+    if (!(idx - idx == 0))
+      return v8::ThrowException(v8::Exception::Error(v8::String::New(
+        "Bad argument: #child() index must be finite")));
+
+    // fractions truncate toward zero, as IntegerValue() would, but without
+    // going through int64_t so huge indexes still range-check as null
+    idx = idx < 0 ? ceil(idx) : floor(idx);
   }
 
   return element->get_child(idx);
@@ -192,8 +429,107 @@ Element::Children(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
+
+  return element->get_children(lazy_option(args[0]));
+}
+
+v8::Handle<v8::Value>
+Element::ChildCount(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Element *element = LibXmlObj::Unwrap<Element>(args.This());
+  assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
-  return element->get_children();
+  return scope.Close(element->get_child_count());
+}
+
+// element.toObject({coalesce: true, attrPrefix: undefined})
+//
+//   <entry id="1">a<b>c</b></entry>
+//   {name: 'entry', attrs: {id: '1'}, children: ['a', {name: 'b', ...}]}
+//
+// coalesce merges neighbouring text and CDATA into one string. attrPrefix
+// puts the attributes on the object itself, prefixed, instead of in attrs.
+// Entity references are replaced by the entity's content; comments and
+// processing instructions do not appear.
+v8::Handle<v8::Value>
+Element::ToObject(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Element *element = LibXmlObj::Unwrap<Element>(args.This());
+  assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
+
+  ObjectOptions options;
+  options.coalesce = true;
+
+  if (args[0]->IsObject()) {
+    v8::Handle<v8::Object> opts = args[0]->ToObject();
+
+    v8::Handle<v8::Value> coalesce =
+      opts->Get(v8::String::NewSymbol("coalesce"));
+    if (!coalesce->IsUndefined())
+      options.coalesce = coalesce->BooleanValue();
+
+    v8::Handle<v8::Value> attr_prefix =
+      opts->Get(v8::String::NewSymbol("attrPrefix"));
+    if (attr_prefix->IsString())
+      options.attr_prefix = *v8::String::Utf8Value(attr_prefix);
+  }
+
+  return scope.Close(element_object(element->xml_obj, options));
+}
+
+// element.toString({format: false, encoding: 'UTF-8', buffer: undefined})
+//
+// Serializes the element and its subtree only. Encodings other than UTF-8
+// come back as a Buffer. Given a buffer, the output is copied into it and the
+// number of bytes written is returned instead.
+v8::Handle<v8::Value>
+Element::ToString(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  Element *element = LibXmlObj::Unwrap<Element>(args.This());
+  assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
+
+  SaveOptions options(args[0]);
+  v8::Handle<v8::Value> target;
+  if (args[0]->IsObject()) {
+    target = args[0]->ToObject()->Get(v8::String::NewSymbol("buffer"));
+    if (!target->IsUndefined() && !IsBuffer(target))
+      return v8::ThrowException(v8::Exception::TypeError(
+        v8::String::New("Bad argument: buffer must be a Buffer")));
+  }
+
+  xmlBuffer* dump = dump_node(element->xml_obj, options);
+  if (!dump) {
+    release_dump_buffer();
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to serialize element")));
+  }
+
+  const char* content = reinterpret_cast<const char*>(xmlBufferContent(dump));
+  int length = xmlBufferLength(dump);
+
+  v8::Handle<v8::Value> result;
+  if (!target.IsEmpty() && !target->IsUndefined()) {
+    if (static_cast<size_t>(length) > BufferLength(target)) {
+      release_dump_buffer();
+      return v8::ThrowException(v8::Exception::RangeError(
+        v8::String::New("Buffer is too small for the element")));
+    }
+    memcpy(BufferData(target), content, length);
+    result = v8::Integer::New(length);
+
+  } else if (options.encoding_name()) {
+    result = NewBuffer(content, length);
+
+  } else {
+    result = NewString(content, length);
+  }
+
+  release_dump_buffer();
+  return scope.Close(result);
 }
 
 v8::Handle<v8::Value>
@@ -201,18 +537,48 @@ Element::Path(const v8::Arguments& args) {
   v8::HandleScope scope;
   Element *element = LibXmlObj::Unwrap<Element>(args.This());
   assert(element);
+  LIBXMLJS_CHECK_DISPOSED(element);
 
   return element->get_path();
 }
 
+Element::~Element() {
+  delete child_index_;
+}
+
+std::vector<xmlNode*>&
+Element::child_index() {
+  if (!child_index_) {
+    child_index_ = new std::vector<xmlNode*>();
+    for (xmlNode* child = xml_obj->children; child; child = child->next)
+      child_index_->push_back(child);
+  }
+
+  return *child_index_;
+}
+
+void
+Element::invalidate_child_index() {
+  delete child_index_;
+  child_index_ = NULL;
+}
+
+void
+Element::ChildrenChanged(xmlNode* parent) {
+  if (parent && parent->type == XML_ELEMENT_NODE && parent->_private)
+    static_cast<Element*>(
+      static_cast<LibXmlObj*>(parent->_private))->invalidate_child_index();
+}
+
 void
 Element::set_name(const char* name) {
+  DocumentMemoryScope memory(xml_obj->doc);
   xmlNodeSetName(xml_obj, (const xmlChar*)name);
 }
 
 v8::Handle<v8::Value>
 Element::get_name() {
-  return v8::String::New((const char*)xml_obj->name);
+  return NewString(xml_obj->name);
 }
 
 // TODO(sprsquish) make these work with namespaces
@@ -227,135 +593,164 @@ Element::get_attr(const char* name) {
 
 // TODO(sprsquish) make these work with namespaces
 void
-Element::set_attr(const char* name,
-                  const char* value) {
+Element::set_attrs(v8::Handle<v8::Object> attrs) {
+  DocumentMemoryScope memory(xml_obj->doc);
+  set_attrs(xml_obj, attrs);
+}
+
+// Sets every property of |attrs| as an attribute, without building
+// Attribute wrappers for them.
+void
+Element::set_attrs(xmlNode* node,
+                   v8::Handle<v8::Object> attrs) {
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[3] = { JsObj::Unwrap(xml_obj),
-                                    v8::String::New(name),
-                                    v8::String::New(value) };
-  v8::Persistent<v8::Object>::New(
-    Attribute::constructor_template->GetFunction()->NewInstance(3, argv));
+  v8::Local<v8::Array> names = attrs->GetPropertyNames();
+  uint32_t length = names->Length();
+
+  for (uint32_t i = 0; i < length; i++) {
+    v8::Local<v8::Value> name = names->Get(i);
+    v8::String::Utf8Value name_str(name);
+    v8::String::Utf8Value value_str(attrs->Get(name));
+    xmlSetProp(node, (const xmlChar*)*name_str, (const xmlChar*)*value_str);
+  }
 }
 
 v8::Handle<v8::Value>
 Element::get_attrs() {
   v8::HandleScope scope;
-  xmlAttr* attr = xml_obj->properties;
+  v8::Local<v8::Array> attributes = v8::Array::New();
+  uint32_t i = 0;
 
-  if (!attr)
-    return v8::Array::New();
+  for (xmlAttr* attr = xml_obj->properties; attr; attr = attr->next)
+    attributes->Set(i++, LIBXMLJS_GET_MAYBE_BUILD(Attribute, xmlAttr, attr));
 
-  v8::Handle<v8::Array> attributes = v8::Array::New();
-  v8::Handle<v8::Function> push = v8::Handle<v8::Function>::Cast(
-    attributes->Get(v8::String::NewSymbol("push")));
-  v8::Handle<v8::Value> argv[1];
-  do {
-    argv[0] = LIBXMLJS_GET_MAYBE_BUILD(Attribute, xmlAttr, attr);
-    push->Call(attributes, 1, argv);
-  } while ((attr = attr->next));
+  return scope.Close(attributes);
+}
 
-  return attributes;
+v8::Handle<v8::Value>
+Element::get_attrs_object(bool qualified) {
+  v8::HandleScope scope;
+  v8::Local<v8::Object> attributes = v8::Object::New();
+  set_attr_values(attributes, xml_obj->properties, std::string(), qualified);
+  return scope.Close(attributes);
 }
 
 void
 Element::add_child(Element* child) {
+  // moving a child also changes the children of its old parent
+  ChildrenChanged(child->xml_obj->parent);
+  invalidate_child_index();
+  Document::UntrackDetached(child->xml_obj);
+  Document::TransferNode(child->xml_obj, xml_obj->doc);
+
+  // text children can be merged into a neighbour and freed
+  DocumentMemoryScope memory(xml_obj->doc);
   xmlAddChild(xml_obj, child->xml_obj);
 }
 
 v8::Handle<v8::Value>
 Element::get_child(double idx) {
-  double i = 1;
-  xmlNode* child = xml_obj->children;
+  std::vector<xmlNode*>& children = child_index();
+  size_t count = children.size();
+  size_t pos;
 
-  while (child && i < idx) {
-    child = child->next;
-    i++;
+  // range-check while still a double so the casts below cannot overflow
+  if (idx < 0) {
+    // child(-1) is the last child
+    if (-idx > count)
+      return v8::Null();
+    pos = count - static_cast<size_t>(-idx);
+
+  } else {
+    if (idx > count)
+      return v8::Null();
+    // child(0) and child(1) are both the first child
+    pos = idx < 1 ? 0 : static_cast<size_t>(idx) - 1;
   }
 
-  if (!child)
+  if (pos >= count)
     return v8::Null();
 
+  xmlNode* child = children[pos];
   return LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, child);
 }
 
 v8::Handle<v8::Value>
-Element::get_children() {
-  v8::HandleScope scope;
-  xmlNode* child = xml_obj->children;
-  xmlNodeSetPtr set = xmlXPathNodeSetCreate(child);
-
-  if (!child)
-    return v8::Array::New();
-
-  do {
-    xmlXPathNodeSetAdd(set, child);
-  } while ((child = child->next));
+Element::get_child_count() {
+  return v8::Integer::New(child_index().size());
+}
 
-  v8::Handle<v8::Array> children = v8::Array::New(set->nodeNr);
-  for (int i = 0; i < set->nodeNr; ++i) {
-    xmlNode *node = set->nodeTab[i];
-    children->Set(v8::Number::New(i),
-                  LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, node));
-  }
+v8::Handle<v8::Value>
+Element::get_children(bool lazy) {
+  v8::HandleScope scope;
+  if (!lazy)
+    return scope.Close(NodeList::NewArray(child_index()));
 
-  return children;
+  std::vector<xmlNode*> children(child_index());
+  return scope.Close(NodeList::New(&children, get_doc()));
 }
 
 v8::Handle<v8::Value>
 Element::get_path() {
   xmlChar* path = xmlGetNodePath(xml_obj);
-  const char* return_path = path ? reinterpret_cast<char*>(path) : "";
-  int str_len = xmlStrlen((const xmlChar*)return_path);
-  v8::Handle<v8::String> js_obj = v8::String::New(return_path, str_len);
+  if (!path)
+    return NewString("");
+
+  v8::Handle<v8::String> js_obj = NewString(path);
   xmlFree(path);
   return js_obj;
 }
 
 void
 Element::set_content(const char* content) {
+  invalidate_child_index();
+
+  DocumentMemoryScope memory(xml_obj->doc);
   xmlNodeSetContent(xml_obj, (const xmlChar*)content);
 }
 
 v8::Handle<v8::Value>
 Element::get_content() {
   xmlChar* content = xmlNodeGetContent(xml_obj);
-  if (*content != 0) {
-    v8::Handle<v8::String> ret_content = v8::String::New((const char *)content);
+  if (!content)
+    return v8::Null();
+
+  if (*content == 0) {
     xmlFree(content);
-    return ret_content;
+    return v8::Null();
   }
 
-  return v8::Null();
+  return AdoptXmlString(content, -1);
 }
 
 v8::Handle<v8::Value>
-Element::find(const char* xpath) {
+Element::find(const char* xpath, bool lazy) {
+  v8::HandleScope scope;
+  std::vector<xmlNode*> nodes;
+
   xmlXPathContext* ctxt = xmlXPathNewContext(xml_obj->doc);
   ctxt->node = xml_obj;
   xmlXPathObject* result = xmlXPathEval((const xmlChar*)xpath, ctxt);
 
-  if (!result) {
-    xmlXPathFreeContext(ctxt);
-    return v8::Array::New(0);
-  }
-
-  if (result->type != XPATH_NODESET) {
-    xmlXPathFreeObject(result);
-    xmlXPathFreeContext(ctxt);
-    return v8::Array::New(0);
-  }
+  if (result && result->type == XPATH_NODESET && result->nodesetval) {
+    xmlNodeSet* set = result->nodesetval;
+    nodes.reserve(set->nodeNr);
 
-  v8::Handle<v8::Array> nodes = v8::Array::New(result->nodesetval->nodeNr);
-  for (int i = 0; i != result->nodesetval->nodeNr; ++i) {
-    xmlNode *node = result->nodesetval->nodeTab[i];
-    nodes->Set(v8::Number::New(i),
-               LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, node));
+    // namespace nodes are copies owned by the result, so they can't outlive it
+    for (int i = 0; i != set->nodeNr; ++i) {
+      if (set->nodeTab[i]->type != XML_NAMESPACE_DECL)
+        nodes.push_back(set->nodeTab[i]);
+    }
   }
 
-  xmlXPathFreeObject(result);
+  if (result)
+    xmlXPathFreeObject(result);
   xmlXPathFreeContext(ctxt);
 
-  return nodes;
+  if (!lazy)
+    return scope.Close(NodeList::NewArray(nodes));
+
+  return scope.Close(NodeList::New(&nodes, get_doc()));
 }
 
 void
@@ -369,15 +764,25 @@ Element::Initialize(v8::Handle<v8::Object> target) {
   LXJS_SET_PROTO_METHOD(constructor_template, "addChild", Element::AddChild);
   LXJS_SET_PROTO_METHOD(constructor_template, "attr", Element::Attr);
   LXJS_SET_PROTO_METHOD(constructor_template, "attrs", Element::Attrs);
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "attrsObject",
+                        Element::AttrsObject);
   LXJS_SET_PROTO_METHOD(constructor_template, "child", Element::Child);
   LXJS_SET_PROTO_METHOD(constructor_template, "children", Element::Children);
+  LXJS_SET_PROTO_METHOD(constructor_template,
+                        "childCount",
+                        Element::ChildCount);
   LXJS_SET_PROTO_METHOD(constructor_template, "find", Element::Find);
   LXJS_SET_PROTO_METHOD(constructor_template, "name", Element::Name);
   LXJS_SET_PROTO_METHOD(constructor_template, "path", Element::Path);
   LXJS_SET_PROTO_METHOD(constructor_template, "text", Element::Text);
+  LXJS_SET_PROTO_METHOD(constructor_template, "toObject", Element::ToObject);
+  LXJS_SET_PROTO_METHOD(constructor_template, "toString", Element::ToString);
 
   target->Set(v8::String::NewSymbol("Element"),
               constructor_template->GetFunction());
+
+  NodeList::Initialize(target);
 }
 
 }  // namespace libxmljs
@@ -2,45 +2,76 @@
 #ifndef SRC_ELEMENT_H_
 #define SRC_ELEMENT_H_
 
+#include <vector>
+
 #include "./libxmljs.h"
 #include "./node.h"
+#include "./slab_pool.h"
 
 namespace libxmljs {
 
 class Element : public Node {
   public:
 
-  explicit Element(xmlNode* node) : Node(node) {}
+  explicit Element(xmlNode* node) : Node(node), child_index_(NULL) {}
+  virtual ~Element();
+
+  static void* operator new(size_t size) {
+    return SlabPool<Element>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    SlabPool<Element>::Free(ptr, size);
+  }
 
   static void Initialize(v8::Handle<v8::Object> target);
   static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
+  // Drops the cached child index of `parent` if it is a wrapped element.
+  // Anything that adds, moves or removes children must call this.
+  static void ChildrenChanged(xmlNode* parent);
+
   protected:
 
   static v8::Handle<v8::Value> New(const v8::Arguments& args);
   static v8::Handle<v8::Value> Name(const v8::Arguments& args);
   static v8::Handle<v8::Value> Attr(const v8::Arguments& args);
   static v8::Handle<v8::Value> Attrs(const v8::Arguments& args);
+  static v8::Handle<v8::Value> AttrsObject(const v8::Arguments& args);
   static v8::Handle<v8::Value> Find(const v8::Arguments& args);
   static v8::Handle<v8::Value> Text(const v8::Arguments& args);
   static v8::Handle<v8::Value> Path(const v8::Arguments& args);
   static v8::Handle<v8::Value> Child(const v8::Arguments& args);
   static v8::Handle<v8::Value> Children(const v8::Arguments& args);
+  static v8::Handle<v8::Value> ChildCount(const v8::Arguments& args);
   static v8::Handle<v8::Value> AddChild(const v8::Arguments& args);
+  static v8::Handle<v8::Value> ToObject(const v8::Arguments& args);
+  static v8::Handle<v8::Value> ToString(const v8::Arguments& args);
 
   void set_name(const char* name);
 
   v8::Handle<v8::Value> get_name();
   v8::Handle<v8::Value> get_child(double idx);
-  v8::Handle<v8::Value> get_children();
+  v8::Handle<v8::Value> get_children(bool lazy);
+  v8::Handle<v8::Value> get_child_count();
   v8::Handle<v8::Value> get_path();
   v8::Handle<v8::Value> get_attr(const char* name);
   v8::Handle<v8::Value> get_attrs();
-  void set_attr(const char* name, const char* value);
+  v8::Handle<v8::Value> get_attrs_object(bool qualified);
+  void set_attrs(v8::Handle<v8::Object> attrs);
+  static void set_attrs(xmlNode* node, v8::Handle<v8::Object> attrs);
   void add_child(Element* child);
   void set_content(const char* content);
   v8::Handle<v8::Value> get_content();
-  v8::Handle<v8::Value> find(const char* xpath);
+  v8::Handle<v8::Value> find(const char* xpath, bool lazy);
+
+  // Child pointers in document order, built on the first indexed access and
+  // dropped whenever this element's children change.
+  std::vector<xmlNode*>& child_index();
+  void invalidate_child_index();
+
+  std::vector<xmlNode*>* child_index_;
+
+  friend class Builder;
 };
 
 }  // namespace libxmljs
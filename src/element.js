@@ -38,11 +38,19 @@ libxml.Element.prototype.node = function() {
   return elem;
 };
 
-libxml.Element.prototype.get = function() {
-  return this.find.apply(this, arguments)[0];
+// only the first match gets a wrapper
+libxml.Element.prototype.get = function(xpath) {
+  return this.find(xpath, {lazy: true})[0];
 };
 
 libxml.Element.prototype.define_namespace = function() {
   var args = arguments.length == 1 ? [null, arguments[0]] : [arguments[0], arguments[1]];
   return new libxml.Namespace(this, args[0], args[1]);
 };
+
+libxml.NodeList.prototype.toArray = function() {
+  var nodes = [];
+  for (var i = 0; i < this.length; i++)
+    nodes.push(this[i]);
+  return nodes;
+};
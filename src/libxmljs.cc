@@ -1,49 +1,92 @@
 // Copyright 2009, Squish Tech, LLC.
 #include "./libxmljs.h"
 
+#include <libxml/catalog.h>
+
 #include <v8.h>
 #include <string>
 
 #include "./natives.h"
+#include "./memory.h"
 #include "./object_wrap.h"
 #include "./document.h"
 #include "./element.h"
 #include "./attribute.h"
+#include "./builder.h"
 #include "./namespace.h"
 #include "./parser.h"
 #include "./sax_parser.h"
+#include "./xml_string.h"
 
 namespace libxmljs {
 
 namespace {
 
+// Detaches the wrappers of a list of namespaces freed with their owner.
+void detach_namespaces(xmlNs* ns) {
+  for (; ns; ns = ns->next) {
+    if (ns->_private)
+      static_cast<Namespace*>(
+        static_cast<LibXmlObj*>(ns->_private))->xml_obj = NULL;
+    ns->_private = NULL;
+  }
+}
+
+// Detaches a wrapper from a node libxml is about to free, so the wrapper does
+// not touch the node again when it is collected.
 void on_libxml_destruct(xmlNode* node) {
   switch (node->type) {
     case XML_DOCUMENT_NODE:
-      delete static_cast<JsObj*>(node->doc->_private);
-      node->doc->_private = NULL;
+    case XML_HTML_DOCUMENT_NODE:
+      // oldNs holds the implicit xml: namespace and the ones of removed nodes
+      detach_namespaces(reinterpret_cast<xmlDoc*>(node)->oldNs);
+      if (node->_private)
+        static_cast<Document*>(
+          static_cast<LibXmlObj*>(node->_private))->xml_obj = NULL;
       break;
 
+    case XML_ELEMENT_NODE:
+      detach_namespaces(node->nsDef);
+      // fall through
+
     default:
-      delete static_cast<JsObj*>(node->_private);
-      node->_private = NULL;
+      Document::NodeFreed(node);
+      if (node->_private)
+        static_cast<Node*>(
+          static_cast<LibXmlObj*>(node->_private))->xml_obj = NULL;
   }
+
+  node->_private = NULL;
 }
 
 }  // namespace
 
-LibXMLJS::LibXMLJS() {
+LibXMLJS::LibXMLJS() : initialized_(false) {}
+
+LibXMLJS::~LibXMLJS() {
+  if (initialized_)
+    xmlCleanupParser();  // As per xmlInitParser(), or memory leak will happen.
+}
+
+void
+LibXMLJS::Initialize() {
+  if (init_.initialized_)
+    return;
+  init_.initialized_ = true;
+
+  InitializeMemory();  // before libxml allocates anything
   xmlInitParser();  // Not always necessary, but necessary for thread safety.
+#ifdef LIBXML_CATALOG_ENABLED
+  // Loaded lazily by the first file parse otherwise, which may be inside an
+  // ArenaScope and would put the catalogs in that document's arena.
+  xmlInitializeCatalog();
+#endif
   // xmlRegisterNodeDefault(on_libxml_construct);
   xmlDeregisterNodeDefault(on_libxml_destruct);
   // xmlThrDefRegisterNodeDefault(on_libxml_construct);
   xmlThrDefDeregisterNodeDefault(on_libxml_destruct);
 }
 
-LibXMLJS::~LibXMLJS() {
-  xmlCleanupParser();  // As per xmlInitParser(), or memory leak will happen.
-}
-
 LibXMLJS LibXMLJS::init_;
 
 static void
@@ -134,6 +177,30 @@ ExecuteString(v8::Handle<v8::String> source,
   return scope.Close(result);
 }
 
+// libxml._defer(callback, ms) schedules a callback on the host's timers. The
+// natives run in a context of their own, which has no setTimeout.
+static v8::Handle<v8::Value>
+Defer(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsFunction,
+                               "Bad argument: must provide a callback");
+
+  v8::Handle<v8::Object> global = v8::Context::GetEntered()->Global();
+  v8::Handle<v8::Value> set_timeout =
+    global->Get(v8::String::NewSymbol("setTimeout"));
+  if (!set_timeout->IsFunction())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("setTimeout is not available")));
+
+  v8::Handle<v8::Value> argv[2] = {
+    args[0],
+    v8::Integer::New(args[1]->Int32Value())
+  };
+  return scope.Close(
+    v8::Handle<v8::Function>::Cast(set_timeout)->Call(global, 2, argv));
+}
+
 static void
 ExecuteNativeJS(const char* filename,
                 const char* data) {
@@ -151,11 +218,19 @@ ExecuteNativeJS(const char* filename,
 void
 InitializeLibXMLJS(v8::Handle<v8::Object> target) {
   v8::HandleScope scope;
+  LibXMLJS::Initialize();
 
   Document::Initialize(target);
 
   Parser::Initialize(target);
   SaxParser::Initialize(target);
+  Builder::Initialize(target);
+
+  LIBXMLJS_SET_METHOD(target,
+                      "externalStringThreshold",
+                      ExternalStringThreshold);
+
+  LIBXMLJS_SET_METHOD(target, "_defer", Defer);
 
   v8::Handle<v8::ObjectTemplate> global = v8::ObjectTemplate::New();
   v8::Handle<v8::Context> context = v8::Context::New(NULL, global);
@@ -37,21 +37,26 @@ do {                                                                          \
     return v8::ThrowException(exception);                                     \
   }
 
-#define BUILD_NODE(klass, type, node)                                         \
+// Wrappers lose their xml_obj when the document under them is freed, either
+// by doc.dispose() or by the document wrapper being collected.
+#define LIBXMLJS_CHECK_DISPOSED(obj)                                          \
+  if (!(obj)->xml_obj)                                                        \
+    return v8::ThrowException(v8::Exception::Error(                           \
+      v8::String::New("The document has been disposed")));
+
+// The wrapper's constructor stores itself on node->_private, so the wrapper's
+// persistent handle is the only reference kept for the node.
+#define BUILD_NODE(klass, node)                                               \
 do {                                                                          \
   klass *__klass##_OBJ = new klass(node);                                     \
-  v8::Handle<v8::Value> __jsobj_ARG[1] = { v8::Null() };                      \
-  v8::Handle<v8::Object> __jsobj_JS =                                         \
-    klass::constructor_template->GetFunction()->NewInstance(1, __jsobj_ARG);  \
-  JsObj::Wrap<type>(node, __jsobj_JS);                                        \
-  __klass##_OBJ->Wrap(__jsobj_JS);                                            \
+  __klass##_OBJ->Wrap(LibXmlObj::Instantiate<klass>());                       \
 } while (0)
 
 #define LIBXMLJS_GET_MAYBE_BUILD(klass, type, node)                           \
   ({                                                                          \
     if (!node->_private)                                                      \
-      BUILD_NODE(klass, type, node);                                          \
-    JsObj::Unwrap<type>(node);                                                \
+      BUILD_NODE(klass, node);                                                \
+    LibXmlObj::GetHandle<type>(node);                                         \
   })
 
 #include <v8.h>
@@ -66,8 +71,14 @@ class LibXMLJS {
   LibXMLJS();
   virtual ~LibXMLJS();
 
+  // Sets libxml2 up from module init rather than from the static
+  // constructor, so the allocation hooks go in right before xmlInitParser.
+  static void Initialize();
+
   private:
 
+  bool initialized_;
+
   static LibXMLJS init_;
 };
 
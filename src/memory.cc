@@ -0,0 +1,256 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./memory.h"
+
+#include <libxml/xmlmemory.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+#include <map>
+
+namespace libxmljs {
+
+namespace {
+
+// Blocks carry no header. Heap blocks are plain malloc blocks, so a block
+// libxml2 allocated before the hooks went in can still be freed through
+// them, and arena blocks are told apart by the chunk they sit in.
+union MaxAlign {
+  double align_double;
+  long double align_long_double;
+  void* align_pointer;
+};
+
+struct ChunkRange {
+  const char* end;
+  Arena* arena;
+};
+
+// Chunks of the live arenas on this thread, by start address. Arena
+// documents are built and freed on the thread that parsed them, other
+// threads have none and never look further than the NULL check.
+typedef std::map<const char*, ChunkRange> ChunkMap;
+__thread ChunkMap* arena_chunks = NULL;
+
+__thread Arena* active_arena = NULL;
+
+// running total for MemoryCounter, per thread so the hooks need no atomics
+__thread ptrdiff_t thread_bytes = 0;
+
+inline size_t
+align(size_t size) {
+  return (size + sizeof(MaxAlign) - 1) & ~(sizeof(MaxAlign) - 1);
+}
+
+inline size_t
+heap_size(void* ptr) {
+#ifdef __APPLE__
+  return malloc_size(ptr);
+#else
+  return malloc_usable_size(ptr);
+#endif
+}
+
+void
+add_chunk(const void* start, size_t size, Arena* arena) {
+  if (!arena_chunks)
+    arena_chunks = new ChunkMap();
+
+  ChunkRange range = { static_cast<const char*>(start) + size, arena };
+  (*arena_chunks)[static_cast<const char*>(start)] = range;
+}
+
+void
+remove_chunk(const void* start) {
+  arena_chunks->erase(static_cast<const char*>(start));
+}
+
+// The chunk |ptr| was allocated from, or NULL for heap blocks.
+const ChunkRange*
+chunk_of(const void* ptr) {
+  if (!arena_chunks || arena_chunks->empty())
+    return NULL;
+
+  const char* p = static_cast<const char*>(ptr);
+  ChunkMap::const_iterator it = arena_chunks->upper_bound(p);
+  if (it == arena_chunks->begin())
+    return NULL;
+
+  --it;
+  return p < it->second.end ? &it->second : NULL;
+}
+
+void*
+allocate_block(size_t size, Arena* arena) {
+  if (arena) {
+    void* ptr = arena->allocate(size);
+    if (ptr)
+      thread_bytes += size;
+    return ptr;
+  }
+
+  void* ptr = malloc(size);
+  if (ptr)
+    thread_bytes += heap_size(ptr);
+  return ptr;
+}
+
+void*
+xml_malloc(size_t size) {
+  return allocate_block(size, active_arena);
+}
+
+void
+xml_free(void* ptr) {
+  // arena blocks go back with the arena
+  if (!ptr || chunk_of(ptr))
+    return;
+
+  thread_bytes -= heap_size(ptr);
+  free(ptr);
+}
+
+void*
+xml_realloc(void* ptr, size_t size) {
+  if (!ptr)
+    return xml_malloc(size);
+
+  const ChunkRange* chunk = chunk_of(ptr);
+
+  // Heap blocks stay on the heap whatever arena is active: they may belong
+  // to something that outlives it, like a global libxml2 sets up lazily.
+  if (!chunk) {
+    size_t old_size = heap_size(ptr);
+    void* grown = realloc(ptr, size);
+    if (!grown)
+      return NULL;
+
+    thread_bytes += static_cast<ptrdiff_t>(heap_size(grown)) - old_size;
+    return grown;
+  }
+
+  // Arena blocks can't grow in place, move them within their own arena.
+  // Their size isn't kept, so copy as much of the rest of the chunk as fits.
+  size_t available = chunk->end - static_cast<const char*>(ptr);
+  void* copy = allocate_block(size, chunk->arena);
+  if (!copy)
+    return NULL;
+
+  memcpy(copy, ptr, available < size ? available : size);
+  return copy;
+}
+
+char*
+xml_strdup(const char* str) {
+  size_t size = strlen(str) + 1;
+  char* copy = static_cast<char*>(xml_malloc(size));
+  if (copy)
+    memcpy(copy, str, size);
+  return copy;
+}
+
+}  // namespace
+
+Arena::Arena() : chunks_(NULL), size_(0) {}
+
+Arena::~Arena() {
+  while (chunks_) {
+    Chunk* next = chunks_->next;
+    remove_chunk(chunks_);
+    free(chunks_);
+    chunks_ = next;
+  }
+}
+
+void*
+Arena::allocate(size_t size) {
+  size = align(size);
+  const size_t offset = align(sizeof(Chunk));
+
+  // big blocks get a chunk of their own behind the one being filled
+  if (size > kChunkSize / 4) {
+    Chunk* chunk = static_cast<Chunk*>(malloc(offset + size));
+    if (!chunk)
+      return NULL;
+    chunk->size = chunk->used = size;
+    size_ += offset + size;
+    add_chunk(chunk, offset + size, this);
+
+    if (chunks_) {
+      chunk->next = chunks_->next;
+      chunks_->next = chunk;
+    } else {
+      chunk->next = NULL;
+      chunks_ = chunk;
+    }
+    return reinterpret_cast<char*>(chunk) + offset;
+  }
+
+  if (!chunks_ || chunks_->size - chunks_->used < size) {
+    Chunk* chunk = static_cast<Chunk*>(malloc(offset + kChunkSize));
+    if (!chunk)
+      return NULL;
+    chunk->next = chunks_;
+    chunk->size = kChunkSize;
+    chunk->used = 0;
+    size_ += offset + kChunkSize;
+    add_chunk(chunk, offset + kChunkSize, this);
+    chunks_ = chunk;
+  }
+
+  void* ptr = reinterpret_cast<char*>(chunks_) + offset + chunks_->used;
+  chunks_->used += size;
+  return ptr;
+}
+
+ArenaScope::ArenaScope(Arena* arena)
+  : previous_(active_arena), active_(arena != NULL) {
+  if (active_)
+    active_arena = arena;
+}
+
+ArenaScope::~ArenaScope() {
+  if (active_)
+    active_arena = previous_;
+}
+
+MemoryCounter::MemoryCounter() : start_(thread_bytes) {}
+
+ptrdiff_t
+MemoryCounter::bytes() const {
+  return thread_bytes - start_;
+}
+
+size_t
+BlockSize(const void* ptr) {
+  if (!ptr || chunk_of(ptr))
+    return 0;
+
+  return heap_size(const_cast<void*>(ptr));
+}
+
+void
+InitializeMemory() {
+  xmlFreeFunc free_func;
+  xmlMallocFunc malloc_func;
+  xmlReallocFunc realloc_func;
+  xmlStrdupFunc strdup_func;
+  xmlMemGet(&free_func, &malloc_func, &realloc_func, &strdup_func);
+
+  // Already ours when a second module init runs. Anything else means some
+  // other user of this libxml2 routed its memory first, and its blocks
+  // would reach our hooks.
+  if (malloc_func == xml_malloc)
+    return;
+  assert(malloc_func == malloc && free_func == free);
+
+  xmlMemSetup(xml_free, xml_malloc, xml_realloc, xml_strdup);
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,86 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_MEMORY_H_
+#define SRC_MEMORY_H_
+
+#include <stddef.h>
+
+namespace libxmljs {
+
+// Chunked bump allocator that can back every libxml2 allocation made while
+// one document is parsed. Blocks are never released on their own: freeing
+// one is a no-op and the chunks all go back at once when the arena is
+// deleted, which the owning Document does after xmlFreeDoc. The hooks find
+// arena blocks through the chunks of the current thread, so an arena and
+// its document are only used on the thread that created them.
+class Arena {
+  public:
+
+  Arena();
+  ~Arena();
+
+  void* allocate(size_t size);
+
+  // bytes held in chunks
+  size_t size() const { return size_; }
+
+  private:
+
+  static const size_t kChunkSize = 64 * 1024;
+
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    size_t used;
+  };
+
+  Chunk* chunks_;  // the first chunk is the one being filled
+  size_t size_;
+};
+
+// Routes libxml2 allocations made on the current thread to |arena| for as
+// long as the scope lives. A NULL arena leaves allocation untouched.
+//
+// Anything libxml2 keeps past the end of the scope must not come from the
+// arena, so the parse functions reset libxml's last error before leaving it
+// and the catalogs are loaded up front. Heap blocks realloc'd in the scope
+// stay on the heap. Nodes of an arena document can't be moved to another
+// document, as their memory goes with the arena.
+class ArenaScope {
+  public:
+
+  explicit ArenaScope(Arena* arena);
+  ~ArenaScope();
+
+  private:
+
+  Arena* previous_;
+  bool active_;
+};
+
+// Net libxml2 bytes allocated on the current thread since construction.
+// Arena blocks count when allocated; their frees don't, as they are only
+// released with the arena.
+class MemoryCounter {
+  public:
+
+  MemoryCounter();
+
+  ptrdiff_t bytes() const;
+
+  private:
+
+  ptrdiff_t start_;
+};
+
+// Size of the heap block at |ptr| as malloc reports it, 0 for arena blocks
+// as their memory is only given back with the arena.
+size_t BlockSize(const void* ptr);
+
+// Installs the allocation hooks with xmlMemSetup. Runs from module init,
+// before xmlInitParser. The hooks keep no header on blocks, so blocks
+// libxml2 allocated with plain malloc before then are freed safely.
+void InitializeMemory();
+
+}  // namespace libxmljs
+
+#endif  // SRC_MEMORY_H_
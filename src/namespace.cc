@@ -3,7 +3,9 @@
 
 #include <libxml/xmlstring.h>
 
+#include "./document.h"
 #include "./node.h"
+#include "./xml_string.h"
 
 
 namespace libxmljs {
@@ -12,22 +14,21 @@ v8::Persistent<v8::FunctionTemplate> Namespace::constructor_template;
 
 v8::Handle<v8::Value>
 Namespace::New(xmlNs* ns) {
-  BUILD_NODE(Namespace, xmlNs, ns);
-  return JsObj::Unwrap<xmlNs>(ns);
+  BUILD_NODE(Namespace, ns);
+  return LibXmlObj::GetHandle<xmlNs>(ns);
 }
 
 v8::Handle<v8::Value>
 Namespace::New(const v8::Arguments& args) {
   v8::HandleScope scope;
-  if (args[0]->StrictEquals(v8::Null()))
-    return args.This();
-
   // TODO(sprsquish): ensure this is an actual Node object
   if (!args[0]->IsObject())
     return v8::ThrowException(v8::Exception::Error(
       v8::String::New("You must provide a node to attach this namespace to")));
 
   libxmljs::Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args[0]->ToObject());
+  LIBXMLJS_CHECK_DISPOSED(node);
+  LIBXMLJS_CHECK_WRITABLE(node->xml_obj->doc);
 
   v8::String::Utf8Value *prefix = NULL, *href = NULL;
 
@@ -36,12 +37,14 @@ Namespace::New(const v8::Arguments& args) {
 
   href = new v8::String::Utf8Value(args[2]->ToString());
 
-  Namespace *ns = new Namespace(node->xml_obj,
-                                prefix ? **prefix : NULL,
-                                **href);
+  Namespace *ns;
+  {
+    DocumentMemoryScope memory(node->xml_obj->doc);
+    ns = new Namespace(node->xml_obj, prefix ? **prefix : NULL, **href);
+  }
   assert(ns->xml_obj);
-  BUILD_NODE(Namespace, xmlNs, ns->xml_obj);
-  v8::Persistent<v8::Object> obj = JsObj::Unwrap<xmlNs>(ns->xml_obj);
+  ns->Wrap(LibXmlObj::Instantiate<Namespace>());
+  v8::Persistent<v8::Object> obj = ns->handle_;
 
   delete prefix;
   delete href;
@@ -49,10 +52,21 @@ Namespace::New(const v8::Arguments& args) {
   return obj;
 }
 
+Namespace::Namespace(xmlNs* ns) : xml_obj(ns) {
+  xml_obj->_private = static_cast<LibXmlObj*>(this);
+}
+
 Namespace::Namespace(xmlNode* node,
                      const char* prefix,
                      const char* href) {
   xml_obj = xmlNewNs(node, (const xmlChar*)href, (const xmlChar*)prefix);
+  xml_obj->_private = static_cast<LibXmlObj*>(this);
+}
+
+Namespace::~Namespace() {
+  // the namespace itself is owned by the node defining it
+  if (xml_obj)
+    xml_obj->_private = NULL;
 }
 
 v8::Handle<v8::Value>
@@ -60,6 +74,7 @@ Namespace::Href(const v8::Arguments& args) {
   v8::HandleScope scope;
   Namespace *ns = LibXmlObj::Unwrap<Namespace>(args.This());
   assert(ns);
+  LIBXMLJS_CHECK_DISPOSED(ns);
   return ns->get_href();
 }
 
@@ -68,14 +83,14 @@ Namespace::Prefix(const v8::Arguments& args) {
   v8::HandleScope scope;
   Namespace *ns = LibXmlObj::Unwrap<Namespace>(args.This());
   assert(ns);
+  LIBXMLJS_CHECK_DISPOSED(ns);
   return ns->get_prefix();
 }
 
 v8::Handle<v8::Value>
 Namespace::get_href() {
   if (xml_obj->href)
-    return v8::String::New((const char*)xml_obj->href,
-                           xmlStrlen(xml_obj->href));
+    return NewString(xml_obj->href, xmlStrlen(xml_obj->href));
 
   return v8::Null();
 }
@@ -83,8 +98,7 @@ Namespace::get_href() {
 v8::Handle<v8::Value>
 Namespace::get_prefix() {
   if (xml_obj->prefix)
-    return v8::String::New((const char*)xml_obj->prefix,
-                           xmlStrlen(xml_obj->prefix));
+    return NewString(xml_obj->prefix, xmlStrlen(xml_obj->prefix));
 
   return v8::Null();
 }
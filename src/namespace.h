@@ -5,6 +5,7 @@
 #include "./libxmljs.h"
 #include "./node.h"
 #include "./object_wrap.h"
+#include "./slab_pool.h"
 
 namespace libxmljs {
 
@@ -15,8 +16,16 @@ class Namespace : public LibXmlObj {
   static void Initialize(v8::Handle<v8::Object> target);
   static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
-  explicit Namespace(xmlNs* ns) : xml_obj(ns) {}
+  explicit Namespace(xmlNs* ns);
   Namespace(xmlNode* node, const char* prefix, const char* href);
+  virtual ~Namespace();
+
+  static void* operator new(size_t size) {
+    return SlabPool<Namespace>::Allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    SlabPool<Namespace>::Free(ptr, size);
+  }
 
   static v8::Handle<v8::Value> New(xmlNs* ns);
 
@@ -15,6 +15,7 @@ Node::Doc(const v8::Arguments& args) {
   v8::HandleScope scope;
   Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args.This());                \
   assert(node);
+  LIBXMLJS_CHECK_DISPOSED(node);
 
   return node->get_doc();
 }
@@ -24,11 +25,14 @@ Node::Namespace(const v8::Arguments& args) {
   v8::HandleScope scope;
   Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args.This());                \
   assert(node);
+  LIBXMLJS_CHECK_DISPOSED(node);
 
   // #namespace() Get the node's namespace
   if (args.Length() == 0)
     return node->get_namespace();
 
+  LIBXMLJS_CHECK_WRITABLE(node->xml_obj->doc);
+
   if (args[0]->IsNull())
     return node->remove_namespace();
 
@@ -36,8 +40,10 @@ Node::Namespace(const v8::Arguments& args) {
 
   // #namespace(ns) libxml.Namespace object was provided
   // TODO(sprsquish): check that it was actually given a namespace obj
-  if (args[0]->IsObject())
+  if (args[0]->IsObject()) {
     ns = LibXmlObj::Unwrap<libxmljs::Namespace>(args[0]->ToObject());
+    LIBXMLJS_CHECK_DISPOSED(ns);
+  }
 
   // #namespace(href) or #namespace(prefix, href)
   // if the namespace has already been defined on the node, just set it
@@ -46,7 +52,7 @@ Node::Namespace(const v8::Arguments& args) {
     xmlNs* found_ns = node->find_namespace(*ns_to_find);
     if (found_ns)
       ns = LibXmlObj::Unwrap<libxmljs::Namespace>(
-        JsObj::Unwrap<xmlNs>(found_ns));
+        LIBXMLJS_GET_MAYBE_BUILD(libxmljs::Namespace, xmlNs, found_ns));
   }
 
   // Namespace does not seem to exist, so create it.
@@ -81,6 +87,7 @@ Node::Parent(const v8::Arguments& args) {
   v8::HandleScope scope;
   Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args.This());                \
   assert(node);
+  LIBXMLJS_CHECK_DISPOSED(node);
 
   return node->get_parent();
 }
@@ -90,6 +97,7 @@ Node::PrevSibling(const v8::Arguments& args) {
   v8::HandleScope scope;
   Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args.This());                \
   assert(node);
+  LIBXMLJS_CHECK_DISPOSED(node);
 
   return node->get_prev_sibling();
 }
@@ -99,21 +107,72 @@ Node::NextSibling(const v8::Arguments& args) {
   v8::HandleScope scope;
   Node *node = LibXmlObj::Unwrap<libxmljs::Node>(args.This());                \
   assert(node);
+  LIBXMLJS_CHECK_DISPOSED(node);
 
   return node->get_next_sibling();
 }
 
+namespace {
+
+// True when a wrapper still points at node or anything under it.
+bool
+has_wrappers(xmlNode* node) {
+  if (node->_private)
+    return true;
+
+  if (node->type == XML_ELEMENT_NODE) {
+    for (xmlAttr* attr = node->properties; attr; attr = attr->next) {
+      if (attr->_private)
+        return true;
+    }
+    for (xmlNs* ns = node->nsDef; ns; ns = ns->next) {
+      if (ns->_private)
+        return true;
+    }
+  }
+
+  for (xmlNode* child = node->children; child; child = child->next) {
+    if (has_wrappers(child))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
 Node::Node(xmlNode* node) : xml_obj(node) {
-  xml_obj->_private = this;
+  xml_obj->_private = static_cast<LibXmlObj*>(this);
 }
 
 Node::~Node() {
-  xmlFree(xml_obj);
+  // xml_obj is cleared by on_libxml_destruct if libxml freed it first
+  if (!xml_obj)
+    return;
+
+  xml_obj->_private = NULL;
+
+  // attached nodes belong to their document
+  xmlNode* top = xml_obj;
+  while (top->parent)
+    top = top->parent;
+  if (top->type == XML_DOCUMENT_NODE || top->type == XML_HTML_DOCUMENT_NODE)
+    return;
+
+  // A tree outside the document goes with the last wrapper into it. Until
+  // then the document's detached list keeps it, and dispose() frees it.
+  if (has_wrappers(top))
+    return;
+
+  Document::UntrackDetached(top);
+
+  // credited to the document the node was made for
+  DocumentMemoryScope memory(top->doc);
+  xmlFreeNode(top);
 }
 
 v8::Handle<v8::Value>
 Node::get_doc() {
-  return JsObj::Unwrap<xmlDoc>(xml_obj->doc);
+  return LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, xml_obj->doc);
 }
 
 v8::Handle<v8::Value>
@@ -127,10 +186,7 @@ Node::get_namespace() {
   if (!xml_obj->ns)
     return v8::Null();
 
-  if (!xml_obj->ns->_private)
-    return Namespace::New(xml_obj->ns);
-
-  return JsObj::Unwrap<xmlNs>(xml_obj->ns);
+  return LIBXMLJS_GET_MAYBE_BUILD(libxmljs::Namespace, xmlNs, xml_obj->ns);
 }
 
 void
@@ -0,0 +1,185 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./node_list.h"
+
+#include <algorithm>
+
+#include "./document.h"
+#include "./element.h"
+#include "./attribute.h"
+
+namespace libxmljs {
+
+v8::Persistent<v8::FunctionTemplate> NodeList::constructor_template;
+
+namespace {
+
+// The nodes are only valid for as long as the document they came from.
+inline Document*
+document_of(v8::Handle<v8::Object> list) {
+  return LibXmlObj::Unwrap<Document>(list->GetInternalField(1)->ToObject());
+}
+
+}  // namespace
+
+v8::Handle<v8::Object>
+NodeList::New(std::vector<xmlNode*>* nodes,
+              v8::Handle<v8::Value> doc) {
+  v8::HandleScope scope;
+  NodeList *list =
+    new NodeList(nodes, LibXmlObj::Unwrap<Document>(doc->ToObject()));
+
+  v8::Handle<v8::Object> obj = LibXmlObj::Instantiate<NodeList>();
+  list->Wrap(obj);
+  obj->SetInternalField(1, doc);
+
+  return scope.Close(obj);
+}
+
+v8::Handle<v8::Array>
+NodeList::NewArray(const std::vector<xmlNode*>& nodes) {
+  v8::HandleScope scope;
+  v8::Local<v8::Array> array = v8::Array::New(nodes.size());
+
+  for (uint32_t i = 0; i < nodes.size(); ++i)
+    array->Set(i, NodeValue(nodes[i]));
+
+  return scope.Close(array);
+}
+
+v8::Handle<v8::Value>
+NodeList::NodeValue(xmlNode* node) {
+  if (node->type == XML_ATTRIBUTE_NODE) {
+    xmlAttr *attr = reinterpret_cast<xmlAttr*>(node);
+    return LIBXMLJS_GET_MAYBE_BUILD(Attribute, xmlAttr, attr);
+  }
+
+  return LIBXMLJS_GET_MAYBE_BUILD(Element, xmlNode, node);
+}
+
+// The log is shared rather than reached through the document, which may be
+// collected before the list when both go in the same GC.
+NodeList::NodeList(std::vector<xmlNode*>* nodes, Document* document)
+  : freed_log_(document->freed_log()) {
+  nodes_.swap(*nodes);
+  freed_log_->ref();
+  freed_seen_ = freed_log_->position();
+}
+
+NodeList::~NodeList() {
+  freed_log_->unref();
+}
+
+v8::Handle<v8::Value>
+NodeList::New(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  return v8::ThrowException(v8::Exception::TypeError(
+    v8::String::New("NodeList objects are returned by children() and find()")));
+}
+
+v8::Handle<v8::Value>
+NodeList::Item(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  NodeList *list = LibXmlObj::Unwrap<NodeList>(args.This());
+  assert(list);
+  LIBXMLJS_CHECK_DISPOSED(document_of(args.This()));
+
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsNumber,
+                               "Bad argument: must provide #item() with a number");
+
+  int64_t index = args[0]->IntegerValue();
+  if (index < 0 || index >= static_cast<int64_t>(list->nodes_.size()))
+    return v8::Null();
+
+  return scope.Close(list->get_item(static_cast<uint32_t>(index)));
+}
+
+v8::Handle<v8::Value>
+NodeList::Length(v8::Local<v8::String> property,
+                 const v8::AccessorInfo& info) {
+  v8::HandleScope scope;
+  NodeList *list = LibXmlObj::Unwrap<NodeList>(info.Holder());
+  assert(list);
+  LIBXMLJS_CHECK_DISPOSED(document_of(info.Holder()));
+
+  return scope.Close(v8::Integer::New(list->nodes_.size()));
+}
+
+v8::Handle<v8::Value>
+NodeList::IndexedGetter(uint32_t index,
+                        const v8::AccessorInfo& info) {
+  v8::HandleScope scope;
+  NodeList *list = LibXmlObj::Unwrap<NodeList>(info.Holder());
+  assert(list);
+  LIBXMLJS_CHECK_DISPOSED(document_of(info.Holder()));
+
+  // fall through to the object itself, so out of range reads are undefined
+  if (index >= list->nodes_.size())
+    return v8::Handle<v8::Value>();
+
+  return scope.Close(list->get_item(index));
+}
+
+v8::Handle<v8::Array>
+NodeList::IndexedEnumerator(const v8::AccessorInfo& info) {
+  v8::HandleScope scope;
+  NodeList *list = LibXmlObj::Unwrap<NodeList>(info.Holder());
+  assert(list);
+
+  if (!document_of(info.Holder())->xml_obj)
+    return scope.Close(v8::Array::New(0));
+
+  v8::Local<v8::Array> indexes = v8::Array::New(list->nodes_.size());
+  for (uint32_t i = 0; i < list->nodes_.size(); ++i)
+    indexes->Set(v8::Integer::New(i), v8::Integer::New(i));
+
+  return scope.Close(indexes);
+}
+
+v8::Handle<v8::Value>
+NodeList::get_item(uint32_t index) {
+  if (freed_seen_ != freed_log_->position())
+    forget_freed();
+
+  xmlNode *node = nodes_[index];
+  if (!node)
+    return v8::Null();
+
+  return NodeValue(node);
+}
+
+void
+NodeList::forget_freed() {
+  std::vector<xmlNode*> freed = freed_log_->freed_since(freed_seen_);
+  freed_seen_ = freed_log_->position();
+  std::sort(freed.begin(), freed.end());
+
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i] && std::binary_search(freed.begin(), freed.end(), nodes_[i]))
+      nodes_[i] = NULL;
+  }
+}
+
+void
+NodeList::Initialize(v8::Handle<v8::Object> target) {
+  v8::HandleScope scope;
+  v8::Local<v8::FunctionTemplate> t = v8::FunctionTemplate::New(New);
+  constructor_template = v8::Persistent<v8::FunctionTemplate>::New(t);
+
+  // field 1 holds the owning document
+  constructor_template->InstanceTemplate()->SetInternalFieldCount(2);
+  constructor_template->InstanceTemplate()->SetAccessor(
+    v8::String::NewSymbol("length"),
+    NodeList::Length);
+  constructor_template->InstanceTemplate()->SetIndexedPropertyHandler(
+    NodeList::IndexedGetter,
+    0, 0, 0,
+    NodeList::IndexedEnumerator);
+
+  LXJS_SET_PROTO_METHOD(constructor_template, "item", NodeList::Item);
+
+  target->Set(v8::String::NewSymbol("NodeList"),
+              constructor_template->GetFunction());
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,65 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_NODE_LIST_H_
+#define SRC_NODE_LIST_H_
+
+#include <libxml/tree.h>
+
+#include <vector>
+
+#include "./libxmljs.h"
+#include "./object_wrap.h"
+
+namespace libxmljs {
+
+class Document;
+class FreedNodeLog;
+
+// Array-like result of children({lazy: true}) and find(xpath, {lazy: true}).
+// Holds the node pointers and only builds a wrapper when an index is read,
+// so taking the length or looking at the first few results of a large set
+// stays cheap. A listed node that libxml2 frees, or that moves to another
+// document, reads as null.
+class NodeList : public LibXmlObj {
+  public:
+
+  static void Initialize(v8::Handle<v8::Object> target);
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  // Takes the nodes out of |nodes|. |doc| keeps the owning document alive
+  // for as long as the list is reachable.
+  static v8::Handle<v8::Object> New(std::vector<xmlNode*>* nodes,
+                                    v8::Handle<v8::Value> doc);
+
+  // The plain Array children() and find() return by default, with a
+  // wrapper for every node.
+  static v8::Handle<v8::Array> NewArray(const std::vector<xmlNode*>& nodes);
+
+  // The wrapper of a listed element or attribute node.
+  static v8::Handle<v8::Value> NodeValue(xmlNode* node);
+
+  protected:
+
+  static v8::Handle<v8::Value> New(const v8::Arguments& args);
+  static v8::Handle<v8::Value> Item(const v8::Arguments& args);
+  static v8::Handle<v8::Value> Length(v8::Local<v8::String> property,
+                                      const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> IndexedGetter(uint32_t index,
+                                             const v8::AccessorInfo& info);
+  static v8::Handle<v8::Array> IndexedEnumerator(const v8::AccessorInfo& info);
+
+  NodeList(std::vector<xmlNode*>* nodes, Document* document);
+  virtual ~NodeList();
+
+  v8::Handle<v8::Value> get_item(uint32_t index);
+
+  // Clears the entries libxml2 has freed since the list last looked.
+  void forget_freed();
+
+  std::vector<xmlNode*> nodes_;
+  FreedNodeLog* freed_log_;
+  size_t freed_seen_;  // position in freed_log_ already applied
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_NODE_LIST_H_
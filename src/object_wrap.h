@@ -28,6 +28,28 @@ class LibXmlObj {
         handle->GetInternalField(0))->Value());
   }
 
+  // Creates the JS object for a wrapper straight from the class's instance
+  // template, so the JS constructor does not run.
+  template <class T>
+  static inline v8::Handle<v8::Object>
+  Instantiate() {
+    static v8::Persistent<v8::ObjectTemplate> instance_template;
+    if (instance_template.IsEmpty())
+      instance_template = v8::Persistent<v8::ObjectTemplate>::New(
+        T::constructor_template->InstanceTemplate());
+
+    return instance_template->NewInstance();
+  }
+
+  // Returns the JS object of the wrapper a libxml struct's _private field
+  // points at.
+  template <class T>
+  static inline v8::Persistent<v8::Object>
+  GetHandle(T* xml_obj) {
+    assert(xml_obj->_private);
+    return static_cast<LibXmlObj*>(xml_obj->_private)->handle_;
+  }
+
   inline void
   Wrap(v8::Handle<v8::Object> handle) {
     assert(handle_.IsEmpty());
@@ -54,55 +76,6 @@ class LibXmlObj {
   }
 };
 
-// Wraps/Unwraps a JS object so it can be set on the XML object's _private
-// field
-class JsObj {
-  public:
-
-  template <class T>
-  static inline void
-  Wrap(T *xml_obj, v8::Handle<v8::Object> js_obj) {
-    xml_obj->_private = new JsObj(js_obj);
-  }
-
-  template <class T>
-  static inline v8::Persistent<v8::Object>
-  Unwrap(T* xml_obj) {
-    assert(xml_obj->_private);
-    JsObj* xmlobj = static_cast<JsObj*>(xml_obj->_private);
-    return xmlobj->_handle;
-  }
-
-  explicit JsObj(v8::Handle<v8::Object> jsObject) {
-    _handle = v8::Persistent<v8::Object>::New(jsObject);
-    MakeWeak();
-  }
-
-  ~JsObj() {
-    if (!_handle.IsEmpty()) {
-      assert(_handle.IsNearDeath());
-      _handle.Dispose();
-      _handle.Clear();
-    }
-  }
-
-  inline void
-  MakeWeak(void) {
-    _handle.MakeWeak(this, WeakCallback);
-  }
-
-  v8::Persistent<v8::Object> _handle;
-
-  private:
-
-  static void
-  WeakCallback(v8::Persistent<v8::Value> value, void *data) {
-    JsObj *obj = static_cast<JsObj*>(data);
-    assert(value == obj->_handle);
-    delete obj;
-  }
-};
-
 }  // namespace libxmljs
 
 #endif  // SRC_OBJECT_WRAP_H_
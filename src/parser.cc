@@ -2,10 +2,45 @@
 #include "./parser.h"
 
 #include "./document.h"
+#include "./memory.h"
 #include "./sax_parser.h"
+#include "./sax_object_builder.h"
 
 namespace libxmljs {
 
+namespace {
+
+// parseString(str, {arena: true}) and friends parse into an arena owned by
+// the resulting document.
+Arena*
+NewArenaIfRequested(v8::Handle<v8::Value> options) {
+  if (!options->IsObject())
+    return NULL;
+
+  v8::Local<v8::Value> arena =
+    options->ToObject()->Get(v8::String::NewSymbol("arena"));
+  return arena->BooleanValue() ? new Arena() : NULL;
+}
+
+// |parsed| is the libxml memory the parse allocated. An arena document is
+// charged for its whole arena instead, slack included.
+v8::Handle<v8::Value>
+BuildDocument(xmlDoc* doc, Arena* arena, ptrdiff_t parsed) {
+  if (doc == NULL) {
+    delete arena;
+    return v8::Null();
+  }
+
+  v8::Persistent<v8::Object> obj =
+    LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, doc);
+  Document *document = LibXmlObj::Unwrap<Document>(obj);
+  document->set_arena(arena);
+  document->adjust_native_bytes(arena ? arena->size() : parsed);
+  return obj;
+}
+
+}  // namespace
+
 v8::Handle<v8::Value>
 ParseString(const v8::Arguments& args) {
   v8::HandleScope scope;
@@ -15,14 +50,20 @@ ParseString(const v8::Arguments& args) {
       v8::String::New("Must supply parseString with a string")));
 
   v8::String::Utf8Value str(args[0]->ToString());
-  xmlResetLastError();
-  xmlDoc *doc = xmlReadMemory(*str, str.length(), NULL, NULL, 0);
-  if (doc == NULL) {
-    xmlFreeDoc(doc);
-    return v8::Null();
+  Arena* arena = NewArenaIfRequested(args[1]);
+  MemoryCounter counter;
+  xmlDoc *doc;
+  {
+    ArenaScope arena_scope(arena);
+    xmlResetLastError();
+    doc = xmlReadMemory(*str, str.length(), NULL, NULL, 0);
+
+    // the last error would outlive the scope but live in the arena
+    if (arena)
+      xmlResetLastError();
   }
 
-  return LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, doc);
+  return BuildDocument(doc, arena, counter.bytes());
 }
 
 v8::Handle<v8::Value>
@@ -34,14 +75,20 @@ ParseHTML(const v8::Arguments& args) {
       v8::String::New("Must supply parseHTML with a string")));
 
   v8::String::Utf8Value str(args[0]->ToString());
-  xmlResetLastError();
-  xmlDoc *doc = htmlReadMemory(*str, str.length(), NULL, NULL, 0);
-  if (doc == NULL) {
-    xmlFreeDoc(doc);
-    return v8::Null();
+  Arena* arena = NewArenaIfRequested(args[1]);
+  MemoryCounter counter;
+  xmlDoc *doc;
+  {
+    ArenaScope arena_scope(arena);
+    xmlResetLastError();
+    doc = htmlReadMemory(*str, str.length(), NULL, NULL, 0);
+
+    // the last error would outlive the scope but live in the arena
+    if (arena)
+      xmlResetLastError();
   }
 
-  return LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, doc);
+  return BuildDocument(doc, arena, counter.bytes());
 }
 
 v8::Handle<v8::Value>
@@ -53,14 +100,20 @@ ParseFile(const v8::Arguments& args) {
       v8::String::New("Must supply parseFile with a filename")));
 
   v8::String::Utf8Value str(args[0]->ToString());
-  xmlResetLastError();
-  xmlDoc *doc = xmlReadFile(*str, NULL, 0);
-  if (doc == NULL) {
-    xmlFreeDoc(doc);
-    return v8::Null();
+  Arena* arena = NewArenaIfRequested(args[1]);
+  MemoryCounter counter;
+  xmlDoc *doc;
+  {
+    ArenaScope arena_scope(arena);
+    xmlResetLastError();
+    doc = xmlReadFile(*str, NULL, 0);
+
+    // the last error would outlive the scope but live in the arena
+    if (arena)
+      xmlResetLastError();
   }
 
-  return LIBXMLJS_GET_MAYBE_BUILD(Document, xmlDoc, doc);
+  return BuildDocument(doc, arena, counter.bytes());
 }
 
 void
@@ -72,5 +125,6 @@ Parser::Initialize(v8::Handle<v8::Object> target) {
   LIBXMLJS_SET_METHOD(target, "parseFile", ParseFile);
 
   SaxParser::Initialize(target);
+  SaxObjectBuilder::Initialize(target);
 }
 }  // namespace libxmljs
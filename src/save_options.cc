@@ -0,0 +1,83 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./save_options.h"
+
+#include <libxml/encoding.h>
+#include <libxml/xmlsave.h>
+
+#include <strings.h>
+
+namespace libxmljs {
+
+SaveOptions::SaveOptions(v8::Handle<v8::Value> options)
+  : format(false),
+    declaration(true),
+    encoding("UTF-8"),
+    compression(0),
+    chunk_size(64 * 1024) {
+  v8::HandleScope scope;
+  if (!options->IsObject())
+    return;
+
+  v8::Handle<v8::Object> opts = options->ToObject();
+
+  v8::Handle<v8::Value> value = opts->Get(v8::String::NewSymbol("format"));
+  if (!value->IsUndefined())
+    format = value->BooleanValue();
+
+  value = opts->Get(v8::String::NewSymbol("declaration"));
+  if (!value->IsUndefined())
+    declaration = value->BooleanValue();
+
+  value = opts->Get(v8::String::NewSymbol("encoding"));
+  if (value->IsString())
+    encoding = *v8::String::Utf8Value(value);
+
+  value = opts->Get(v8::String::NewSymbol("compression"));
+  if (value->IsNumber()) {
+    int64_t level = value->IntegerValue();
+    compression = level < 0 ? 0 : level > 9 ? 9 : static_cast<int>(level);
+  }
+
+  value = opts->Get(v8::String::NewSymbol("chunkSize"));
+  if (value->IsNumber() && value->IntegerValue() > 0)
+    chunk_size = static_cast<size_t>(value->IntegerValue());
+}
+
+int
+SaveOptions::flags() const {
+  int flags = 0;
+  if (format)
+    flags |= XML_SAVE_FORMAT;
+  if (!declaration)
+    flags |= XML_SAVE_NO_DECL;
+  return flags;
+}
+
+const char*
+SaveOptions::encoding_name() const {
+  if (strcasecmp(encoding.c_str(), "UTF-8") == 0)
+    return NULL;
+  return encoding.c_str();
+}
+
+bool
+SaveOptions::valid_encoding() const {
+  const char* name = encoding_name();
+  if (!name)
+    return true;
+
+  xmlCharEncodingHandler* handler = xmlFindCharEncodingHandler(name);
+  if (!handler)
+    return false;
+
+  xmlCharEncCloseFunc(handler);
+  return true;
+}
+
+xmlCharEncodingHandler*
+SaveOptions::encoder() const {
+  const char* name = encoding_name();
+  return name ? xmlFindCharEncodingHandler(name) : NULL;
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,45 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SAVE_OPTIONS_H_
+#define SRC_SAVE_OPTIONS_H_
+
+#include <libxml/encoding.h>
+#include <v8.h>
+
+#include <stddef.h>
+
+#include <string>
+
+namespace libxmljs {
+
+// Options shared by the serializers:
+//
+//   format       indent the output, defaults to false
+//   encoding     output encoding, defaults to UTF-8
+//   declaration  write the <?xml ...?> declaration, defaults to true
+//   compression  gzip level 0-9 for files, defaults to 0
+//   chunkSize    bytes per Buffer handed to a chunk callback, defaults to 64KB
+struct SaveOptions {
+  explicit SaveOptions(v8::Handle<v8::Value> options);
+
+  // xmlSaveOption flags for xmlSaveToIO
+  int flags() const;
+
+  // NULL for UTF-8, so libxml2 skips the conversion
+  const char* encoding_name() const;
+
+  // false when libxml2 has no handler for the requested encoding
+  bool valid_encoding() const;
+
+  // handler for an xmlOutputBuffer, which takes ownership; NULL for UTF-8
+  xmlCharEncodingHandler* encoder() const;
+
+  bool format;
+  bool declaration;
+  std::string encoding;
+  int compression;
+  size_t chunk_size;
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SAVE_OPTIONS_H_
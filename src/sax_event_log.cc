@@ -0,0 +1,353 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./sax_event_log.h"
+
+#include <string.h>
+
+#include "./sax_parser.h"
+
+namespace libxmljs {
+
+const char SaxEventLog::kMagic[] = "LXJSSAX1";
+
+SaxEventLogWriter::SaxEventLogWriter(FILE* file)
+  : file_(file),
+    failed_(false) {
+  buffer_.reserve(kBufferSize);
+  write_bytes(SaxEventLog::kMagic, SaxEventLog::kMagicLength);
+}
+
+SaxEventLogWriter::~SaxEventLogWriter() {
+  close();
+}
+
+SaxEventLogWriter*
+SaxEventLogWriter::Open(const char* filename) {
+  FILE* file = fopen(filename, "wb");
+  if (!file)
+    return NULL;
+
+  return new SaxEventLogWriter(file);
+}
+
+void
+SaxEventLogWriter::start_document() {
+  buffer_ += static_cast<char>(SaxEventLog::START_DOCUMENT);
+  maybe_flush();
+}
+
+void
+SaxEventLogWriter::end_document() {
+  buffer_ += static_cast<char>(SaxEventLog::END_DOCUMENT);
+  flush();
+}
+
+void
+SaxEventLogWriter::start_element_ns(const xmlChar* localname,
+                                    const xmlChar* prefix,
+                                    const xmlChar* uri,
+                                    int nb_namespaces,
+                                    const xmlChar** namespaces,
+                                    int nb_attributes,
+                                    const xmlChar** attributes) {
+  int i;
+
+  // names have to be defined before the record that uses them
+  std::vector<uint32_t> ids;
+  ids.push_back(intern(localname));
+  ids.push_back(intern(prefix));
+  ids.push_back(intern(uri));
+
+  if (!namespaces)
+    nb_namespaces = 0;
+  for (i = 0; i < 2 * nb_namespaces; i++)
+    ids.push_back(intern(namespaces[i]));
+
+  if (!attributes)
+    nb_attributes = 0;
+  for (i = 0; i < 5 * nb_attributes; i += 5) {
+    ids.push_back(intern(attributes[i+0]));
+    ids.push_back(intern(attributes[i+1]));
+    ids.push_back(intern(attributes[i+2]));
+  }
+
+  buffer_ += static_cast<char>(SaxEventLog::START_ELEMENT_NS);
+  write_varint(ids[0]);
+  write_varint(ids[1]);
+  write_varint(ids[2]);
+
+  size_t id = 3;
+  write_varint(nb_namespaces);
+  for (i = 0; i < 2 * nb_namespaces; i++)
+    write_varint(ids[id++]);
+
+  // Each attribute is [localname, prefix, URI, value, end]
+  write_varint(nb_attributes);
+  for (i = 0; i < 5 * nb_attributes; i += 5) {
+    write_varint(ids[id++]);
+    write_varint(ids[id++]);
+    write_varint(ids[id++]);
+
+    uint32_t len = attributes[i+4] - attributes[i+3];
+    write_varint(len);
+    write_bytes((const char*)attributes[i+3], len);
+  }
+
+  maybe_flush();
+}
+
+void
+SaxEventLogWriter::end_element_ns(const xmlChar* localname,
+                                  const xmlChar* prefix,
+                                  const xmlChar* uri) {
+  uint32_t local_id = intern(localname);
+  uint32_t prefix_id = intern(prefix);
+  uint32_t uri_id = intern(uri);
+
+  buffer_ += static_cast<char>(SaxEventLog::END_ELEMENT_NS);
+  write_varint(local_id);
+  write_varint(prefix_id);
+  write_varint(uri_id);
+  maybe_flush();
+}
+
+void
+SaxEventLogWriter::text(SaxEventLog::Opcode opcode,
+                        const xmlChar* str,
+                        int len) {
+  if (len < 0)
+    len = xmlStrlen(str);
+
+  buffer_ += static_cast<char>(opcode);
+  write_varint(len);
+  write_bytes((const char*)str, len);
+  maybe_flush();
+}
+
+bool
+SaxEventLogWriter::flush() {
+  if (!failed_ && file_) {
+    bool written = buffer_.empty() ||
+                   fwrite(buffer_.data(), 1, buffer_.size(), file_) ==
+                   buffer_.size();
+    failed_ = !written || fflush(file_) != 0;
+  }
+
+  buffer_.clear();
+  return !failed_;
+}
+
+bool
+SaxEventLogWriter::close() {
+  if (!file_)
+    return !failed_;
+
+  flush();
+  if (fclose(file_) != 0)
+    failed_ = true;
+  file_ = NULL;
+  return !failed_;
+}
+
+uint32_t
+SaxEventLogWriter::intern(const xmlChar* str) {
+  if (!str)
+    return 0;
+
+  std::string name((const char*)str);
+  std::map<std::string, uint32_t>::iterator it = ids_.find(name);
+  if (it != ids_.end())
+    return it->second;
+
+  uint32_t id = ids_.size() + 1;
+  ids_[name] = id;
+
+  buffer_ += static_cast<char>(SaxEventLog::STRING);
+  write_varint(name.size());
+  write_bytes(name.data(), name.size());
+  return id;
+}
+
+void
+SaxEventLogWriter::write_varint(uint32_t value) {
+  while (value >= 0x80) {
+    buffer_ += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  buffer_ += static_cast<char>(value);
+}
+
+void
+SaxEventLogWriter::write_bytes(const char* data,
+                               size_t len) {
+  buffer_.append(data, len);
+}
+
+void
+SaxEventLogWriter::maybe_flush() {
+  if (buffer_.size() >= kBufferSize)
+    flush();
+}
+
+SaxEventLogReader::SaxEventLogReader(const char* data,
+                                     size_t size)
+  : pos_(data),
+    end_(data + size) {
+}
+
+bool
+SaxEventLogReader::replay(SaxParser* parser) {
+  if (static_cast<size_t>(end_ - pos_) < SaxEventLog::kMagicLength ||
+      memcmp(pos_, SaxEventLog::kMagic, SaxEventLog::kMagicLength) != 0)
+    return false;
+  pos_ += SaxEventLog::kMagicLength;
+
+  std::vector<const xmlChar*> namespaces;
+  std::vector<const xmlChar*> attributes;
+  std::string message;
+
+  while (pos_ < end_ && !parser->stopped_) {
+    int opcode = *pos_++;
+    const xmlChar *localname, *prefix, *uri;
+    const char* data;
+    uint32_t len, count, i;
+
+    switch (opcode) {
+      case SaxEventLog::STRING:
+        if (!read_bytes(&data, &len))
+          return false;
+        strings_.push_back(std::string(data, len));
+        break;
+
+      case SaxEventLog::START_DOCUMENT:
+        parser->start_document();
+        break;
+
+      case SaxEventLog::END_DOCUMENT:
+        parser->end_document();
+        break;
+
+      case SaxEventLog::START_ELEMENT_NS:
+        if (!read_name(&localname) || !read_name(&prefix) || !read_name(&uri))
+          return false;
+
+        // a namespace takes two ids of a byte or more
+        if (!read_count(&count, 2))
+          return false;
+        namespaces.resize(2 * count);
+        for (i = 0; i < 2 * count; i++) {
+          if (!read_name(&namespaces[i]))
+            return false;
+        }
+
+        // an attribute takes three ids and a length
+        if (!read_count(&len, 4))
+          return false;
+        attributes.resize(5 * len);
+        for (i = 0; i < 5 * len; i += 5) {
+          if (!read_name(&attributes[i+0]) ||
+              !read_name(&attributes[i+1]) ||
+              !read_name(&attributes[i+2]) ||
+              !read_bytes(&data, &count))
+            return false;
+          attributes[i+3] = (const xmlChar*)data;
+          attributes[i+4] = (const xmlChar*)data + count;
+        }
+
+        parser->start_element_ns(localname,
+                                 prefix,
+                                 uri,
+                                 namespaces.size() / 2,
+                                 namespaces.empty() ? NULL : &namespaces[0],
+                                 attributes.size() / 5,
+                                 0,
+                                 attributes.empty() ? NULL : &attributes[0]);
+        break;
+
+      case SaxEventLog::END_ELEMENT_NS:
+        if (!read_name(&localname) || !read_name(&prefix) || !read_name(&uri))
+          return false;
+        parser->end_element_ns(localname, prefix, uri);
+        break;
+
+      case SaxEventLog::CHARACTERS:
+        if (!read_bytes(&data, &len))
+          return false;
+        parser->characters((const xmlChar*)data, len);
+        break;
+
+      case SaxEventLog::CDATA_BLOCK:
+        if (!read_bytes(&data, &len))
+          return false;
+        parser->cdata_block((const xmlChar*)data, len);
+        break;
+
+      // these callbacks expect NUL terminated strings
+      case SaxEventLog::COMMENT:
+      case SaxEventLog::WARNING:
+      case SaxEventLog::ERROR:
+        if (!read_bytes(&data, &len))
+          return false;
+        message.assign(data, len);
+
+        if (opcode == SaxEventLog::COMMENT)
+          parser->comment((const xmlChar*)message.c_str());
+        else if (opcode == SaxEventLog::WARNING)
+          parser->warning(message.c_str());
+        else
+          parser->error(message.c_str());
+        break;
+
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+SaxEventLogReader::read_varint(uint32_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (pos_ >= end_)
+      return false;
+
+    unsigned char byte = *pos_++;
+    *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+// Reads the number of items that follow, each at least |min_item_size|
+// bytes, so a corrupt count fails here instead of allocating for it.
+bool
+SaxEventLogReader::read_count(uint32_t* count,
+                              size_t min_item_size) {
+  return read_varint(count) &&
+         *count <= static_cast<size_t>(end_ - pos_) / min_item_size;
+}
+
+bool
+SaxEventLogReader::read_name(const xmlChar** name) {
+  uint32_t id;
+  if (!read_varint(&id) || id > strings_.size())
+    return false;
+
+  *name = id ? (const xmlChar*)strings_[id - 1].c_str() : NULL;
+  return true;
+}
+
+bool
+SaxEventLogReader::read_bytes(const char** data,
+                              uint32_t* len) {
+  if (!read_varint(len) || *len > static_cast<size_t>(end_ - pos_))
+    return false;
+
+  *data = pos_;
+  pos_ += *len;
+  return true;
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,114 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SAX_EVENT_LOG_H_
+#define SRC_SAX_EVENT_LOG_H_
+
+#include <libxml/xmlstring.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace libxmljs {
+
+class SaxParser;
+
+// Compact binary log of the events a SaxParser delivers. After the
+// "LXJSSAX1" header the file is a flat sequence of records, each an opcode
+// byte followed by varint encoded numbers and raw UTF-8 bytes. Element,
+// attribute and namespace names are interned: the first use of a name is
+// preceded by a STRING record and later records refer to it by id, with 0
+// standing for NULL. Text is stored inline so a replay can hand it to the
+// callbacks straight out of the mapped file.
+class SaxEventLog {
+  public:
+
+  enum Opcode {
+    STRING = 1,
+    START_DOCUMENT,
+    END_DOCUMENT,
+    START_ELEMENT_NS,
+    END_ELEMENT_NS,
+    CHARACTERS,
+    COMMENT,
+    CDATA_BLOCK,
+    WARNING,
+    ERROR
+  };
+
+  static const char kMagic[];
+  static const size_t kMagicLength = 8;
+};
+
+class SaxEventLogWriter {
+  public:
+
+  explicit SaxEventLogWriter(FILE* file);
+  ~SaxEventLogWriter();
+
+  static SaxEventLogWriter* Open(const char* filename);
+
+  void start_document();
+  void end_document();
+  void start_element_ns(const xmlChar* localname,
+                        const xmlChar* prefix,
+                        const xmlChar* uri,
+                        int nb_namespaces,
+                        const xmlChar** namespaces,
+                        int nb_attributes,
+                        const xmlChar** attributes);
+  void end_element_ns(const xmlChar* localname,
+                      const xmlChar* prefix,
+                      const xmlChar* uri);
+  void text(SaxEventLog::Opcode opcode, const xmlChar* str, int len);
+
+  bool flush();
+
+  // Flushes and closes the file. false if any write failed, in which case
+  // the log is incomplete.
+  bool close();
+
+  // true once a write failed; later events are dropped
+  bool failed() const { return failed_; }
+
+  private:
+
+  static const size_t kBufferSize = 64 * 1024;
+
+  uint32_t intern(const xmlChar* str);
+  void write_varint(uint32_t value);
+  void write_bytes(const char* data, size_t len);
+  void maybe_flush();
+
+  FILE* file_;
+  bool failed_;
+  std::string buffer_;
+  std::map<std::string, uint32_t> ids_;
+};
+
+// Replays a log written by SaxEventLogWriter into a parser's callbacks.
+class SaxEventLogReader {
+  public:
+
+  SaxEventLogReader(const char* data, size_t size);
+
+  // Returns false if the log is truncated or malformed.
+  bool replay(SaxParser* parser);
+
+  private:
+
+  bool read_varint(uint32_t* value);
+  bool read_count(uint32_t* count, size_t min_item_size);
+  bool read_name(const xmlChar** name);
+  bool read_bytes(const char** data, uint32_t* len);
+
+  const char* pos_;
+  const char* end_;
+  std::vector<std::string> strings_;
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SAX_EVENT_LOG_H_
@@ -0,0 +1,472 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./sax_event_queue.h"
+
+#include <libxml/xmlstring.h>
+
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cassert>  // for assert()
+
+namespace libxmljs {
+
+#define LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context)                             \
+({                                                                            \
+  _xmlParserCtxt* the_context = static_cast<_xmlParserCtxt*>(context);        \
+  static_cast<SaxEventQueue*>(the_context->_private);                         \
+})
+
+// The JS thread asks for a stop through the queue, the parser has to be
+// stopped from the thread that is running it.
+#define LIBXML_JS_RETURN_IF_STOPPED(queue)                                    \
+  if (queue->stop_requested()) {                                              \
+    xmlStopParser(queue->context_);                                           \
+    return;                                                                   \
+  }
+
+namespace {
+
+const size_t kAlign = sizeof(void*);
+
+// Bytes a string takes up in an arena page, including its terminator and
+// worst case alignment padding.
+inline size_t
+payload_of(const xmlChar* str, int len) {
+  if (!str)
+    return 0;
+
+  return (len < 0 ? xmlStrlen(str) : len) + 1 + kAlign;
+}
+
+}  // namespace
+
+SaxEventQueue::SaxEventQueue(xmlParserCtxt* context)
+  : context_(context),
+    events_(new SaxEvent[kCapacity]),
+    head_(0),
+    tail_(0),
+    closed_(0),
+    stop_requested_(0),
+    consumer_waiting_(0),
+    producer_waiting_(0),
+    first_page_(NULL),
+    write_page_(NULL),
+    read_page_(NULL),
+    cursor_(NULL) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&readable_cond_, NULL);
+  pthread_cond_init(&writable_cond_, NULL);
+}
+
+// Runs after the parse thread has been joined. Events left behind by a stop
+// still hold pages, so free the chain from the oldest page still alive.
+SaxEventQueue::~SaxEventQueue() {
+  SaxArenaPage* page = read_page_ ? read_page_ : first_page_;
+  while (page) {
+    SaxArenaPage* next = page->next;
+    free(page);
+    page = next;
+  }
+
+  pthread_cond_destroy(&writable_cond_);
+  pthread_cond_destroy(&readable_cond_);
+  pthread_mutex_destroy(&mutex_);
+  delete [] events_;
+}
+
+void*
+SaxEventQueue::Run(void* data) {
+  SaxEventQueue* queue = static_cast<SaxEventQueue*>(data);
+  xmlParseDocument(queue->context_);
+  queue->close();
+  return NULL;
+}
+
+bool
+SaxEventQueue::readable() const {
+  return __atomic_load_n(&head_, __ATOMIC_SEQ_CST) != tail_ ||
+         __atomic_load_n(&closed_, __ATOMIC_SEQ_CST);
+}
+
+bool
+SaxEventQueue::writable() const {
+  return head_ - __atomic_load_n(&tail_, __ATOMIC_SEQ_CST) < kCapacity;
+}
+
+// Spins for a while, as the other side is usually only a moment behind, then
+// sleeps. The waiting flag and the index the other side publishes are both
+// sequentially consistent, so either it sees the flag and signals under the
+// mutex, or the check made under the mutex sees its update.
+void
+SaxEventQueue::wait(bool (SaxEventQueue::*ready)() const,
+                    pthread_cond_t* cond,
+                    int* waiting) {
+  for (int i = 0; i < kSpins; ++i) {
+    if ((this->*ready)())
+      return;
+    sched_yield();
+  }
+
+  pthread_mutex_lock(&mutex_);
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  while (!(this->*ready)())
+    pthread_cond_wait(cond, &mutex_);
+  __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void
+SaxEventQueue::wake(pthread_cond_t* cond, int* waiting) {
+  if (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+    return;
+
+  pthread_mutex_lock(&mutex_);
+  pthread_cond_signal(cond);
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Returns the oldest unconsumed event, waiting for the parse thread if
+// necessary. Returns NULL once the parse thread is done and the queue is empty.
+SaxEvent*
+SaxEventQueue::next() {
+  for (;;) {
+    if (__atomic_load_n(&head_, __ATOMIC_ACQUIRE) != tail_) {
+      SaxEvent* event = &events_[tail_ & (kCapacity - 1)];
+
+      // Pages are filled in order, so nothing references the previous page
+      // once an event on a later one shows up.
+      if (event->page && event->page != read_page_) {
+        free(read_page_);
+        read_page_ = event->page;
+      }
+      return event;
+    }
+
+    // closed_ is released after the last publish, so head_ is final here
+    if (__atomic_load_n(&closed_, __ATOMIC_ACQUIRE)) {
+      if (__atomic_load_n(&head_, __ATOMIC_ACQUIRE) == tail_)
+        return NULL;
+      continue;
+    }
+
+    wait(&SaxEventQueue::readable, &readable_cond_, &consumer_waiting_);
+  }
+}
+
+void
+SaxEventQueue::pop() {
+  __atomic_store_n(&tail_, tail_ + 1, __ATOMIC_SEQ_CST);
+  wake(&writable_cond_, &producer_waiting_);
+}
+
+void
+SaxEventQueue::stop() {
+  __atomic_store_n(&stop_requested_, 1, __ATOMIC_RELEASE);
+}
+
+bool
+SaxEventQueue::stop_requested() const {
+  return __atomic_load_n(&stop_requested_, __ATOMIC_ACQUIRE);
+}
+
+// Claims the next free slot, and makes sure the current arena page has room
+// for |payload| bytes so that an event never spans two pages.
+SaxEvent*
+SaxEventQueue::reserve(SaxEvent::Type type,
+                       size_t payload) {
+  if (head_ - __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) >= kCapacity)
+    wait(&SaxEventQueue::writable, &writable_cond_, &producer_waiting_);
+
+  if (payload && (!write_page_ ||
+                  write_page_->size - write_page_->used < payload)) {
+    size_t size = payload > kPageSize ? payload : kPageSize;
+    SaxArenaPage* page = static_cast<SaxArenaPage*>(
+      malloc(sizeof(SaxArenaPage) + size));
+    page->next = NULL;
+    page->size = size;
+    page->used = 0;
+
+    if (write_page_)
+      write_page_->next = page;
+    else
+      first_page_ = page;
+
+    write_page_ = page;
+    cursor_ = page->data;
+  }
+
+  SaxEvent* event = &events_[head_ & (kCapacity - 1)];
+  memset(event, 0, sizeof(SaxEvent));
+  event->type = type;
+  event->page = write_page_;
+  return event;
+}
+
+void
+SaxEventQueue::publish() {
+  __atomic_store_n(&head_, head_ + 1, __ATOMIC_SEQ_CST);
+  wake(&readable_cond_, &consumer_waiting_);
+}
+
+void
+SaxEventQueue::close() {
+  __atomic_store_n(&closed_, 1, __ATOMIC_SEQ_CST);
+  wake(&readable_cond_, &consumer_waiting_);
+}
+
+void*
+SaxEventQueue::alloc(size_t size) {
+  size_t offset = cursor_ - write_page_->data;
+  size_t padding = (kAlign - offset % kAlign) % kAlign;
+  assert(write_page_->used + padding + size <= write_page_->size);
+
+  void* ptr = cursor_ + padding;
+  cursor_ += padding + size;
+  write_page_->used = cursor_ - write_page_->data;
+  return ptr;
+}
+
+xmlChar*
+SaxEventQueue::copy(const xmlChar* str,
+                    int len) {
+  if (!str)
+    return NULL;
+
+  if (len < 0)
+    len = xmlStrlen(str);
+
+  xmlChar* dest = static_cast<xmlChar*>(alloc(len + 1));
+  memcpy(dest, str, len);
+  dest[len] = 0;
+  return dest;
+}
+
+const xmlChar**
+SaxEventQueue::alloc_pointers(int count) {
+  return static_cast<const xmlChar**>(alloc(count * sizeof(xmlChar*)));
+}
+
+xmlSAXHandler*
+SaxEventQueue::sax_handler() {
+  static xmlSAXHandler handler = {
+    0,  // internalSubset;
+    0,  // isStandalone;
+    0,  // hasInternalSubset;
+    0,  // hasExternalSubset;
+    0,  // resolveEntity;
+    0,  // getEntity;
+    0,  // entityDecl;
+    0,  // notationDecl;
+    0,  // attributeDecl;
+    0,  // elementDecl;
+    0,  // unparsedEntityDecl;
+    0,  // setDocumentLocator;
+    SaxEventQueueCallback::start_document,  // startDocument;
+    SaxEventQueueCallback::end_document,  // endDocument;
+    0,  // startElement;
+    0,  // endElement;
+    0,  // reference;
+    SaxEventQueueCallback::characters,  // characters;
+    0,  // ignorableWhitespace;
+    0,  // processingInstruction;
+    SaxEventQueueCallback::comment,  // comment;
+    SaxEventQueueCallback::warning,  // warning;
+    SaxEventQueueCallback::error,  // error;
+    0,  // fatalError; /* unused error() get all the errors */
+    0,  // getParameterEntity;
+    SaxEventQueueCallback::cdata_block,  // cdataBlock;
+    0,  // externalSubset;
+    XML_SAX2_MAGIC, /* force SAX2 */
+    NULL,  /* _private */
+    SaxEventQueueCallback::start_element_ns,  // startElementNs;
+    SaxEventQueueCallback::end_element_ns,  // endElementNs;
+    0  // serror
+  };
+  return &handler;
+}
+
+void
+SaxEventQueueCallback::start_document(void* context) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  queue->reserve(SaxEvent::START_DOCUMENT, 0);
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::end_document(void* context) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  queue->reserve(SaxEvent::END_DOCUMENT, 0);
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::start_element_ns(void* context,
+                                        const xmlChar* localname,
+                                        const xmlChar* prefix,
+                                        const xmlChar* uri,
+                                        int nb_namespaces,
+                                        const xmlChar** namespaces,
+                                        int nb_attributes,
+                                        int nb_defaulted,
+                                        const xmlChar** attributes) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  int i;
+
+  size_t payload = payload_of(localname, -1) +
+                   payload_of(prefix, -1) +
+                   payload_of(uri, -1);
+
+  if (namespaces) {
+    payload += 2 * nb_namespaces * sizeof(xmlChar*) + kAlign;
+    for (i = 0; i < 2 * nb_namespaces; i++)
+      payload += payload_of(namespaces[i], -1);
+  }
+
+  // Each attribute is [localname, prefix, URI, value, end]
+  if (attributes) {
+    payload += 5 * nb_attributes * sizeof(xmlChar*) + kAlign;
+    for (i = 0; i < 5 * nb_attributes; i += 5) {
+      payload += payload_of(attributes[i+0], -1) +
+                 payload_of(attributes[i+1], -1) +
+                 payload_of(attributes[i+2], -1) +
+                 payload_of(attributes[i+3], attributes[i+4]-attributes[i+3]);
+    }
+  }
+
+  SaxEvent* event = queue->reserve(SaxEvent::START_ELEMENT_NS, payload);
+  event->value = queue->copy(localname, -1);
+  event->prefix = queue->copy(prefix, -1);
+  event->uri = queue->copy(uri, -1);
+
+  if (namespaces) {
+    const xmlChar** ns = queue->alloc_pointers(2 * nb_namespaces);
+    for (i = 0; i < 2 * nb_namespaces; i++)
+      ns[i] = queue->copy(namespaces[i], -1);
+
+    event->nb_namespaces = nb_namespaces;
+    event->namespaces = ns;
+  }
+
+  if (attributes) {
+    const xmlChar** attrs = queue->alloc_pointers(5 * nb_attributes);
+    for (i = 0; i < 5 * nb_attributes; i += 5) {
+      int len = attributes[i+4] - attributes[i+3];
+      attrs[i+0] = queue->copy(attributes[i+0], -1);
+      attrs[i+1] = queue->copy(attributes[i+1], -1);
+      attrs[i+2] = queue->copy(attributes[i+2], -1);
+      attrs[i+3] = queue->copy(attributes[i+3], len);
+      attrs[i+4] = attrs[i+3] + len;
+    }
+
+    event->nb_attributes = nb_attributes;
+    event->attributes = attrs;
+  }
+
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::end_element_ns(void* context,
+                                      const xmlChar* localname,
+                                      const xmlChar* prefix,
+                                      const xmlChar* uri) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+
+  size_t payload = payload_of(localname, -1) +
+                   payload_of(prefix, -1) +
+                   payload_of(uri, -1);
+
+  SaxEvent* event = queue->reserve(SaxEvent::END_ELEMENT_NS, payload);
+  event->value = queue->copy(localname, -1);
+  event->prefix = queue->copy(prefix, -1);
+  event->uri = queue->copy(uri, -1);
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::characters(void* context,
+                                  const xmlChar* ch,
+                                  int len) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  SaxEvent* event = queue->reserve(SaxEvent::CHARACTERS, payload_of(ch, len));
+  event->value = queue->copy(ch, len);
+  event->len = len;
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::comment(void* context,
+                               const xmlChar* value) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  SaxEvent* event = queue->reserve(SaxEvent::COMMENT, payload_of(value, -1));
+  event->value = queue->copy(value, -1);
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::cdata_block(void* context,
+                                   const xmlChar* value,
+                                   int len) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+  SaxEvent* event = queue->reserve(SaxEvent::CDATA_BLOCK,
+                                   payload_of(value, len));
+  event->value = queue->copy(value, len);
+  event->len = len;
+  queue->publish();
+}
+
+void
+SaxEventQueueCallback::warning(void* context,
+                               const char* msg,
+                               ...) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+
+  char* message;
+
+  va_list args;
+  va_start(args, msg);
+  vasprintf(&message, msg, args);
+  va_end(args);
+
+  const xmlChar* str = (const xmlChar*)message;
+  SaxEvent* event = queue->reserve(SaxEvent::WARNING, payload_of(str, -1));
+  event->value = queue->copy(str, -1);
+  queue->publish();
+
+  free(message);
+}
+
+void
+SaxEventQueueCallback::error(void* context,
+                             const char* msg,
+                             ...) {
+  SaxEventQueue* queue = LIBXML_JS_GET_QUEUE_FROM_CONTEXT(context);
+  LIBXML_JS_RETURN_IF_STOPPED(queue);
+
+  char* message;
+
+  va_list args;
+  va_start(args, msg);
+  vasprintf(&message, msg, args);
+  va_end(args);
+
+  const xmlChar* str = (const xmlChar*)message;
+  SaxEvent* event = queue->reserve(SaxEvent::ERROR, payload_of(str, -1));
+  event->value = queue->copy(str, -1);
+  queue->publish();
+
+  free(message);
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,169 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SAX_EVENT_QUEUE_H_
+#define SRC_SAX_EVENT_QUEUE_H_
+
+#include <libxml/parser.h>
+
+#include <pthread.h>
+#include <stddef.h>
+
+namespace libxmljs {
+
+// Block of memory the parse thread copies event strings into. A page is
+// released by the consuming thread once it has seen an event on a later page.
+// Pages are chained in the order they were filled.
+struct SaxArenaPage {
+  SaxArenaPage* next;
+  size_t size;
+  size_t used;
+  char data[1];
+};
+
+// A single SAX event as recorded by the parse thread. All strings point into
+// the event's arena page and are NUL terminated.
+struct SaxEvent {
+  enum Type {
+    START_DOCUMENT,
+    END_DOCUMENT,
+    START_ELEMENT_NS,
+    END_ELEMENT_NS,
+    CHARACTERS,
+    COMMENT,
+    CDATA_BLOCK,
+    WARNING,
+    ERROR
+  };
+
+  Type type;
+  SaxArenaPage* page;
+
+  // localname for elements, the text for everything else
+  const xmlChar* value;
+  const xmlChar* prefix;
+  const xmlChar* uri;
+  int len;
+
+  int nb_namespaces;
+  const xmlChar** namespaces;
+  int nb_attributes;
+  const xmlChar** attributes;
+};
+
+// Single producer, single consumer ring buffer of SAX events. libxml2 runs on
+// a parse thread and writes events with the SaxEventQueueCallback handlers;
+// the JS thread drains them with next()/pop(). The indexes are published with
+// acquire/release atomics. A side that finds the ring empty or full spins
+// briefly, then sleeps on a condition variable until the other side moves.
+class SaxEventQueue {
+  public:
+
+  explicit SaxEventQueue(xmlParserCtxt* context);
+  ~SaxEventQueue();
+
+  static xmlSAXHandler* sax_handler();
+
+  // pthread entry point, runs xmlParseDocument on the queue's context.
+  static void* Run(void* queue);
+
+  // consumer side
+  SaxEvent* next();
+  void pop();
+  void stop();
+
+  bool stop_requested() const;
+
+  // producer side
+  SaxEvent* reserve(SaxEvent::Type type, size_t payload);
+  void publish();
+  void close();
+  xmlChar* copy(const xmlChar* str, int len);
+  const xmlChar** alloc_pointers(int count);
+
+  xmlParserCtxt* context_;
+
+  private:
+
+  static const unsigned int kCapacity = 4096;  // must be a power of two
+  static const size_t kPageSize = 64 * 1024;
+  static const int kSpins = 64;  // yields before going to sleep
+
+  void* alloc(size_t size);
+
+  // blocks until |ready| holds, woken through |cond|
+  void wait(bool (SaxEventQueue::*ready)() const,
+            pthread_cond_t* cond,
+            int* waiting);
+  void wake(pthread_cond_t* cond, int* waiting);
+  bool readable() const;
+  bool writable() const;
+
+  SaxEvent* events_;
+  unsigned int head_;  // written by the producer only
+  unsigned int tail_;  // written by the consumer only
+  int closed_;
+  int stop_requested_;
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t readable_cond_;
+  pthread_cond_t writable_cond_;
+  int consumer_waiting_;
+  int producer_waiting_;
+
+  SaxArenaPage* first_page_;  // head of the chain until the consumer frees it
+  SaxArenaPage* write_page_;  // producer's current page
+  SaxArenaPage* read_page_;   // page of the last event the consumer saw
+  char* cursor_;
+};
+
+struct SaxEventQueueCallback {
+  static void
+  start_document(void* context);
+
+  static void
+  end_document(void* context);
+
+  static void
+  start_element_ns(void* context,
+                   const xmlChar* localname,
+                   const xmlChar* prefix,
+                   const xmlChar* uri,
+                   int nb_namespaces,
+                   const xmlChar** namespaces,
+                   int nb_attributes,
+                   int nb_defaulted,
+                   const xmlChar** attributes);
+
+  static void
+  end_element_ns(void* context,
+                 const xmlChar* localname,
+                 const xmlChar* prefix,
+                 const xmlChar* uri);
+
+  static void
+  characters(void* context,
+             const xmlChar* ch,
+             int len);
+
+  static void
+  comment(void* context,
+          const xmlChar* value);
+
+  static void
+  cdata_block(void* context,
+              const xmlChar* value,
+              int len);
+
+  static void
+  warning(void* context,
+          const char* fmt,
+          ...);
+
+  static void
+  error(void* context,
+        const char* fmt,
+        ...);
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SAX_EVENT_QUEUE_H_
@@ -0,0 +1,354 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./sax_object_builder.h"
+
+#include <libxml/parserInternals.h>  // for IS_BLANK_CH
+#include <libxml/xmlerror.h>
+#include <libxml/xmlstring.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./buffer.h"
+#include "./xml_string.h"
+
+namespace libxmljs {
+
+#define LIBXML_JS_GET_BUILDER_FROM_CONTEXT(context)                           \
+  static_cast<SaxObjectBuilder*>(context)
+
+namespace {
+
+bool
+is_blank(const std::string& text) {
+  for (size_t i = 0; i < text.size(); i++) {
+    if (!IS_BLANK_CH(text[i]))
+      return false;
+  }
+  return true;
+}
+
+std::string
+qualified_name(const xmlChar* localname,
+               const xmlChar* prefix) {
+  std::string name;
+  if (prefix) {
+    name = (const char*)prefix;
+    name += ':';
+  }
+  name += (const char*)localname;
+  return name;
+}
+
+}  // namespace
+
+SaxObjectBuilder::SaxObjectBuilder(v8::Handle<v8::Value> options)
+  : attr_prefix_("@"),
+    text_key_("#text") {
+  v8::HandleScope scope;
+
+  if (options->IsObject()) {
+    v8::Handle<v8::Object> opts = options->ToObject();
+
+    v8::Handle<v8::Value> attr_prefix =
+      opts->Get(v8::String::NewSymbol("attrPrefix"));
+    if (attr_prefix->IsString())
+      attr_prefix_ = *v8::String::Utf8Value(attr_prefix);
+
+    v8::Handle<v8::Value> text_key =
+      opts->Get(v8::String::NewSymbol("textKey"));
+    if (text_key->IsString())
+      text_key_ = *v8::String::Utf8Value(text_key);
+
+    v8::Handle<v8::Value> arrays = opts->Get(v8::String::NewSymbol("arrays"));
+    if (arrays->IsArray()) {
+      v8::Handle<v8::Array> list = v8::Handle<v8::Array>::Cast(arrays);
+      for (unsigned int i = 0; i < list->Length(); i++) {
+        v8::String::Utf8Value entry(list->Get(i));
+        // an empty entry matches nothing
+        if (entry.length() > 0)
+          arrays_.push_back(*entry);
+      }
+    }
+  }
+
+  // frame 0 holds the result object
+  frames_.push_back(Frame());
+  frames_.back().has_fields = true;
+
+  objects_ = v8::Persistent<v8::Array>::New(v8::Array::New());
+  objects_->Set(0, v8::Object::New());
+}
+
+SaxObjectBuilder::~SaxObjectBuilder() {
+  objects_.Dispose();
+}
+
+v8::Handle<v8::Value>
+SaxObjectBuilder::ParseString(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxObjectBuilder builder(args[1]);
+  int status;
+
+  if (IsBuffer(args[0])) {
+    status = xmlSAXUserParseMemory(sax_handler(),
+                                   &builder,
+                                   BufferData(args[0]),
+                                   BufferLength(args[0]));
+
+  } else {
+    LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                                 IsString,
+                                 "Bad Argument: parseStringToObject requires "
+                                 "a string or Buffer");
+
+    v8::String::Utf8Value str(args[0]->ToString());
+    status = xmlSAXUserParseMemory(sax_handler(),
+                                   &builder,
+                                   *str,
+                                   str.length());
+  }
+
+  if (status != 0)
+    return v8::ThrowException(builder.parse_error());
+
+  return scope.Close(builder.result());
+}
+
+v8::Handle<v8::Value>
+SaxObjectBuilder::ParseFile(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsString,
+                               "Bad Argument: parseFileToObject requires a "
+                               "filename");
+
+  SaxObjectBuilder builder(args[1]);
+  v8::String::Utf8Value filename(args[0]->ToString());
+
+  if (xmlSAXUserParseFile(sax_handler(), &builder, *filename) != 0)
+    return v8::ThrowException(builder.parse_error());
+
+  return scope.Close(builder.result());
+}
+
+void
+SaxObjectBuilder::start_element_ns(const xmlChar* localname,
+                                   const xmlChar* prefix,
+                                   int nb_attributes,
+                                   const xmlChar** attributes) {
+  v8::HandleScope scope;
+
+  frames_.back().has_fields = true;
+
+  Frame frame;
+  frame.name = qualified_name(localname, prefix);
+  frame.path = frames_.back().path + "/" + frame.name;
+  frame.has_fields = nb_attributes > 0;
+
+  // Each attribute is [localname, prefix, URI, value, end]
+  v8::Handle<v8::Object> obj = v8::Object::New();
+  for (int i = 0; i < nb_attributes * 5; i += 5) {
+    std::string key = attr_prefix_ +
+                      qualified_name(attributes[i+0], attributes[i+1]);
+    obj->Set(NewString(key.data(), key.size()),
+             NewString(attributes[i+3],
+                       attributes[i+4] - attributes[i+3]));
+  }
+
+  objects_->Set(frames_.size(), obj);
+  frames_.push_back(frame);
+}
+
+void
+SaxObjectBuilder::end_element_ns() {
+  v8::HandleScope scope;
+
+  unsigned int depth = frames_.size() - 1;
+  Frame& frame = frames_.back();
+  v8::Handle<v8::Value> value;
+
+  if (!frame.has_fields) {
+    value = NewString(frame.text.data(), frame.text.size());
+
+  } else {
+    v8::Handle<v8::Object> obj = objects_->Get(depth)->ToObject();
+    if (!is_blank(frame.text))
+      obj->Set(NewString(text_key_.data(), text_key_.size()),
+               NewString(frame.text.data(), frame.text.size()));
+    value = obj;
+  }
+
+  // Repeated names turn into arrays. Element values are never arrays
+  // otherwise, so an existing array is always one we created.
+  v8::Handle<v8::Object> parent = objects_->Get(depth - 1)->ToObject();
+  v8::Handle<v8::String> key =
+    NewString(frame.name.data(), frame.name.size());
+
+  if (parent->HasRealNamedProperty(key)) {
+    v8::Handle<v8::Value> existing = parent->Get(key);
+    if (existing->IsArray()) {
+      v8::Handle<v8::Array> list = v8::Handle<v8::Array>::Cast(existing);
+      list->Set(list->Length(), value);
+
+    } else {
+      v8::Handle<v8::Array> list = v8::Array::New(2);
+      list->Set(0, existing);
+      list->Set(1, value);
+      parent->Set(key, list);
+    }
+
+  } else if (force_array(frame)) {
+    v8::Handle<v8::Array> list = v8::Array::New(1);
+    list->Set(0, value);
+    parent->Set(key, list);
+
+  } else {
+    parent->Set(key, value);
+  }
+
+  objects_->Set(depth, v8::Undefined());
+  frames_.pop_back();
+}
+
+void
+SaxObjectBuilder::characters(const xmlChar* ch,
+                             int len) {
+  frames_.back().text.append((const char*)ch, len);
+}
+
+void
+SaxObjectBuilder::error(const char* message) {
+  if (error_.empty())
+    error_ = message;
+}
+
+v8::Handle<v8::Value>
+SaxObjectBuilder::result() {
+  return objects_->Get(0);
+}
+
+v8::Handle<v8::Value>
+SaxObjectBuilder::parse_error() const {
+  if (!error_.empty())
+    return v8::Exception::Error(NewString(error_.data(), error_.size()));
+
+  // failures such as a missing file never reach the error callback
+  xmlError* last = xmlGetLastError();
+  if (last && last->message)
+    return v8::Exception::Error(v8::String::New(last->message));
+
+  return v8::Exception::Error(v8::String::New("Unable to parse"));
+}
+
+bool
+SaxObjectBuilder::force_array(const Frame& frame) const {
+  for (size_t i = 0; i < arrays_.size(); i++) {
+    if (arrays_[i] == (arrays_[i][0] == '/' ? frame.path : frame.name))
+      return true;
+  }
+  return false;
+}
+
+xmlSAXHandler*
+SaxObjectBuilder::sax_handler() {
+  static xmlSAXHandler handler = {
+    0,  // internalSubset;
+    0,  // isStandalone;
+    0,  // hasInternalSubset;
+    0,  // hasExternalSubset;
+    0,  // resolveEntity;
+    0,  // getEntity;
+    0,  // entityDecl;
+    0,  // notationDecl;
+    0,  // attributeDecl;
+    0,  // elementDecl;
+    0,  // unparsedEntityDecl;
+    0,  // setDocumentLocator;
+    0,  // startDocument;
+    0,  // endDocument;
+    0,  // startElement;
+    0,  // endElement;
+    0,  // reference;
+    SaxObjectBuilderCallback::characters,  // characters;
+    0,  // ignorableWhitespace;
+    0,  // processingInstruction;
+    0,  // comment;
+    0,  // warning;
+    SaxObjectBuilderCallback::error,  // error;
+    0,  // fatalError; /* unused error() get all the errors */
+    0,  // getParameterEntity;
+    SaxObjectBuilderCallback::characters,  // cdataBlock;
+    0,  // externalSubset;
+    XML_SAX2_MAGIC, /* force SAX2 */
+    NULL,  /* _private */
+    SaxObjectBuilderCallback::start_element_ns,  // startElementNs;
+    SaxObjectBuilderCallback::end_element_ns,  // endElementNs;
+    0  // serror
+  };
+  return &handler;
+}
+
+void
+SaxObjectBuilderCallback::start_element_ns(void* context,
+                                           const xmlChar* localname,
+                                           const xmlChar* prefix,
+                                           const xmlChar* uri,
+                                           int nb_namespaces,
+                                           const xmlChar** namespaces,
+                                           int nb_attributes,
+                                           int nb_defaulted,
+                                           const xmlChar** attributes) {
+  SaxObjectBuilder* builder = LIBXML_JS_GET_BUILDER_FROM_CONTEXT(context);
+  builder->start_element_ns(localname, prefix, nb_attributes, attributes);
+}
+
+void
+SaxObjectBuilderCallback::end_element_ns(void* context,
+                                         const xmlChar* localname,
+                                         const xmlChar* prefix,
+                                         const xmlChar* uri) {
+  SaxObjectBuilder* builder = LIBXML_JS_GET_BUILDER_FROM_CONTEXT(context);
+  builder->end_element_ns();
+}
+
+void
+SaxObjectBuilderCallback::characters(void* context,
+                                     const xmlChar* ch,
+                                     int len) {
+  SaxObjectBuilder* builder = LIBXML_JS_GET_BUILDER_FROM_CONTEXT(context);
+  builder->characters(ch, len);
+}
+
+void
+SaxObjectBuilderCallback::error(void* context,
+                                const char* msg,
+                                ...) {
+  SaxObjectBuilder* builder = LIBXML_JS_GET_BUILDER_FROM_CONTEXT(context);
+
+  char* message;
+
+  va_list args;
+  va_start(args, msg);
+  vasprintf(&message, msg, args);
+  va_end(args);
+
+  builder->error(message);
+
+  free(message);
+}
+
+void
+SaxObjectBuilder::Initialize(v8::Handle<v8::Object> target) {
+  v8::HandleScope scope;
+
+  LIBXMLJS_SET_METHOD(target,
+                      "parseStringToObject",
+                      SaxObjectBuilder::ParseString);
+
+  LIBXMLJS_SET_METHOD(target,
+                      "parseFileToObject",
+                      SaxObjectBuilder::ParseFile);
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,102 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SAX_OBJECT_BUILDER_H_
+#define SRC_SAX_OBJECT_BUILDER_H_
+
+#include <v8.h>
+
+#include <libxml/parser.h>
+
+#include <string>
+#include <vector>
+
+#include "./libxmljs.h"
+
+namespace libxmljs {
+
+// Converts a document straight into plain JS objects from SAX events,
+// without going through the JS callbacks:
+//
+//   <feed lang="en"><entry>a</entry><entry>b</entry></feed>
+//   { feed: { '@lang': 'en', entry: ['a', 'b'] } }
+//
+// Options:
+//   attrPrefix  prefix for attribute keys, defaults to '@'
+//   textKey     key for the text of elements with attributes or children,
+//               defaults to '#text'
+//   arrays      element names or absolute paths (/feed/entry) that always
+//               become arrays, even when they occur once
+class SaxObjectBuilder {
+  public:
+
+  explicit SaxObjectBuilder(v8::Handle<v8::Value> options);
+  ~SaxObjectBuilder();
+
+  static void Initialize(v8::Handle<v8::Object> target);
+
+  static v8::Handle<v8::Value> ParseString(const v8::Arguments& args);
+  static v8::Handle<v8::Value> ParseFile(const v8::Arguments& args);
+
+  void start_element_ns(const xmlChar* localname,
+                        const xmlChar* prefix,
+                        int nb_attributes,
+                        const xmlChar** attributes);
+  void end_element_ns();
+  void characters(const xmlChar* ch, int len);
+  void error(const char* message);
+
+  v8::Handle<v8::Value> result();
+  v8::Handle<v8::Value> parse_error() const;
+
+  private:
+
+  struct Frame {
+    std::string name;
+    std::string path;
+    std::string text;
+    bool has_fields;  // attributes or child elements
+  };
+
+  static xmlSAXHandler* sax_handler();
+  bool force_array(const Frame& frame) const;
+
+  std::string attr_prefix_;
+  std::string text_key_;
+  std::vector<std::string> arrays_;
+
+  std::vector<Frame> frames_;
+  v8::Persistent<v8::Array> objects_;  // JS object of each open frame
+  std::string error_;
+};
+
+struct SaxObjectBuilderCallback {
+  static void
+  start_element_ns(void* context,
+                   const xmlChar* localname,
+                   const xmlChar* prefix,
+                   const xmlChar* uri,
+                   int nb_namespaces,
+                   const xmlChar** namespaces,
+                   int nb_attributes,
+                   int nb_defaulted,
+                   const xmlChar** attributes);
+
+  static void
+  end_element_ns(void* context,
+                 const xmlChar* localname,
+                 const xmlChar* prefix,
+                 const xmlChar* uri);
+
+  static void
+  characters(void* context,
+             const xmlChar* ch,
+             int len);
+
+  static void
+  error(void* context,
+        const char* fmt,
+        ...);
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SAX_OBJECT_BUILDER_H_
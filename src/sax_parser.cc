@@ -1,9 +1,77 @@
 // Copyright 2009, Squish Tech, LLC.
 #include "./sax_parser.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+
+#include "./buffer.h"
+#include "./xml_string.h"
+
 namespace libxmljs {
 
-SaxParser::SaxParser() : sax_handler_(new _xmlSAXHandler) {
+namespace {
+
+uint64_t
+now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+const char* const kEventNames[] = {
+  "startDocument",
+  "endDocument",
+  "startElementNS",
+  "endElementNS",
+  "characters",
+  "comment",
+  "cdata",
+  "warning",
+  "error"
+};
+
+const char kLogWriteError[] = "Unable to write the event log";
+
+// Event names are string literals, so the pointer identifies the event.
+// Each name becomes a symbol once rather than a new string per callback.
+v8::Handle<v8::String>
+event_symbol(const char* what) {
+  static std::map<const char*, v8::Persistent<v8::String> > symbols;
+  v8::Persistent<v8::String>& symbol = symbols[what];
+  if (symbol.IsEmpty())
+    symbol = v8::Persistent<v8::String>::New(v8::String::NewSymbol(what));
+  return symbol;
+}
+
+}  // namespace
+
+v8::Persistent<v8::Object> SaxParser::skip_subtree_control;
+v8::Persistent<v8::Object> SaxParser::stop_control;
+
+SaxParser::SaxParser()
+  : context_(NULL),
+    sax_handler_(new _xmlSAXHandler),
+    threaded_(false),
+    queued_bytes_(0),
+    high_water_mark_(16 * 1024),
+    paused_(false),
+    processing_(false),
+    reset_pending_(false),
+    need_drain_(false),
+    queue_(NULL),
+    depth_(0),
+    skip_depth_(0),
+    stopped_(false),
+    recorder_(NULL),
+    stats_enabled_(false) {
+  memset(&stats_, 0, sizeof(stats_));
   xmlSAXHandler tmp = {
     0,  // internalSubset;
     0,  // isStandalone;
@@ -41,11 +109,26 @@ SaxParser::SaxParser() : sax_handler_(new _xmlSAXHandler) {
   *sax_handler_ = tmp;
 }
 
+SaxParser::~SaxParser() {
+  delete recorder_;
+  releaseContext();
+  delete sax_handler_;
+  callbacks_.Dispose();
+}
+
 void
 SaxParser::initializeContext() {
   assert(context_);
   context_->validate = 0;
   context_->_private = this;
+  reset_state();
+}
+
+void
+SaxParser::reset_state() {
+  depth_ = 0;
+  skip_depth_ = 0;
+  stopped_ = false;
 }
 
 void
@@ -113,37 +196,172 @@ SaxParser::Callback(const char* what,
                     int argc,
                     v8::Handle<v8::Value> argv[]) {
   v8::HandleScope scope;
+  v8::Handle<v8::Value> control = Dispatch(what, argc, argv);
+
+  if (control.IsEmpty() || !control->IsObject())
+    return;
+
+  if (control->StrictEquals(skip_subtree_control))
+    skip_subtree();
+  else if (control->StrictEquals(stop_control))
+    stop();
+}
+
+v8::Handle<v8::Value>
+SaxParser::Dispatch(const char* what,
+                    int argc,
+                    v8::Handle<v8::Value> argv[]) {
+  v8::HandleScope scope;
 
   v8::Handle<v8::Function> callback = v8::Handle<v8::Function>::Cast(
-    callbacks_->Get(v8::String::New("callback")));
+    callbacks_->Get(v8::String::NewSymbol("callback")));
   assert(callback->IsFunction());
 
   v8::Handle<v8::Value> args[argc+1];
-  args[0] = v8::String::New(what);
+  args[0] = event_symbol(what);
   for (int i = 1; i <= argc; i++) {
     args[i] = argv[i-1];
   }
 
   v8::Handle<v8::Object> global = v8::Context::GetCurrent()->Global();
-  callback->Call(global, argc+1, args);
+  v8::Handle<v8::Value> control;
+
+  if (stats_enabled_) {
+    uint64_t start = now_ns();
+    control = callback->Call(global, argc+1, args);
+    stats_.js_ns += now_ns() - start;
+    stats_.callbacks++;
+  } else {
+    control = callback->Call(global, argc+1, args);
+  }
+
+  return scope.Close(control);
+}
+
+// Drops everything up to the end tag of the innermost open element.
+void
+SaxParser::skip_subtree() {
+  if (depth_ > 0 && !skip_depth_)
+    skip_depth_ = depth_;
+}
+
+void
+SaxParser::stop() {
+  if (stopped_)
+    return;
+
+  stopped_ = true;
+
+  if (queue_)
+    queue_->stop();
+  else if (context_)
+    xmlStopParser(context_);
 }
 
 v8::Handle<v8::Value>
-SaxParser::Push(const v8::Arguments& args) {
+SaxParser::SkipSubtree(const v8::Arguments& args) {
   v8::HandleScope scope;
-  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
-                               IsString,
-                               "Bad Argument: parseString requires a string");
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
 
+  parser->skip_subtree();
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+SaxParser::Stop(const v8::Arguments& args) {
+  v8::HandleScope scope;
   SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
 
-  v8::String::Utf8Value parsable(args[0]->ToString());
+  parser->stop();
+  return args.This();
+}
+
+// Queues a string or Buffer chunk and parses whatever is queued unless the
+// parser is paused. Returns false once the queue reaches the high water mark,
+// the caller should then wait for the drain callback before pushing more.
+v8::Handle<v8::Value>
+SaxParser::Push(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
 
   bool terminate = args.Length() > 1 ? args[1]->ToBoolean()->Value() : false;
 
-  parser->push(*parsable, parsable.length(), terminate);
+  if (IsBuffer(args[0])) {
+    parser->push_chunk(BufferData(args[0]), BufferLength(args[0]), terminate);
 
-  return v8::Boolean::New(true);
+  } else {
+    LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                                 IsString,
+                                 "Bad Argument: push requires a string or "
+                                 "Buffer");
+
+    v8::String::Utf8Value parsable(args[0]->ToString());
+    parser->push_chunk(*parsable, parsable.length(), terminate);
+  }
+
+  if (parser->recorder_ && parser->recorder_->failed())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New(kLogWriteError)));
+
+  bool below_mark = parser->queued_bytes_ < parser->high_water_mark_;
+  if (!below_mark)
+    parser->need_drain_ = true;
+
+  return v8::Boolean::New(below_mark);
+}
+
+v8::Handle<v8::Value>
+SaxParser::Reset(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  if (parser->processing_) {
+    // called from a callback, xmlParseChunk is still using the context.
+    // Stop the chunk here and reset once it has returned.
+    parser->reset_pending_ = true;
+    parser->stop();
+  } else {
+    parser->reset_push_parser();
+  }
+
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+SaxParser::Pause(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  parser->paused_ = true;
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+SaxParser::Resume(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  parser->paused_ = false;
+  if (!parser->processing_)
+    parser->process_queue();
+
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+SaxParser::HighWaterMark(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  if (args.Length() == 0)
+    return v8::Integer::NewFromUnsigned(parser->high_water_mark_);
+
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsNumber,
+                               "Bad argument: highWaterMark requires a number");
+
+  parser->high_water_mark_ = args[0]->Uint32Value();
+  return args.This();
 }
 
 void
@@ -152,11 +370,235 @@ SaxParser::initialize_push_parser() {
   initializeContext();
 }
 
+// Throws away the document in progress so the context can take a new one.
+// Chunks still waiting in the push queue are kept.
+void
+SaxParser::reset_push_parser() {
+  reset_pending_ = false;
+  xmlCtxtResetPush(context_, NULL, 0, NULL, NULL);
+  initializeContext();
+}
+
+// A terminating chunk ends the current document, the next push starts a new
+// one on the same context.
 void
 SaxParser::push(const char* str,
                 unsigned int size,
                 bool terminate = false) {
-  xmlParseChunk(context_, str, size, terminate);
+  if (stats_enabled_) {
+    uint64_t start = now_ns(), js_start = stats_.js_ns;
+    xmlParseChunk(context_, str, size, terminate);
+    account_native_time(start, js_start);
+    stats_.bytes += size;
+  } else {
+    xmlParseChunk(context_, str, size, terminate);
+  }
+
+  if (terminate || reset_pending_)
+    reset_push_parser();
+}
+
+// Parses straight from the caller's data when nothing is waiting. Chunks
+// are only copied into the queue when the parser is paused, already inside
+// a callback, or behind chunks queued earlier.
+void
+SaxParser::push_chunk(const char* str,
+                      size_t size,
+                      bool terminate) {
+  if (paused_ || processing_ || !push_queue_.empty()) {
+    enqueue(str, size, terminate);
+    if (!paused_ && !processing_)
+      process_queue();
+    return;
+  }
+
+  processing_ = true;
+  push(str, size, terminate);
+  processing_ = false;
+
+  // callbacks may have pushed more while this chunk was parsed
+  process_queue();
+}
+
+void
+SaxParser::enqueue(const char* str,
+                   size_t size,
+                   bool terminate) {
+  push_queue_.push_back(PushChunk());
+  push_queue_.back().data.assign(str, size);
+  push_queue_.back().terminate = terminate;
+  queued_bytes_ += size;
+}
+
+// Callbacks may pause the parser or push more data, so the queue is only
+// consumed from the outermost call and one chunk at a time.
+void
+SaxParser::process_queue() {
+  processing_ = true;
+
+  while (!paused_ && !push_queue_.empty()) {
+    PushChunk chunk;
+    chunk.data.swap(push_queue_.front().data);
+    chunk.terminate = push_queue_.front().terminate;
+    push_queue_.pop_front();
+    queued_bytes_ -= chunk.data.size();
+
+    push(chunk.data.data(), chunk.data.size(), chunk.terminate);
+  }
+
+  processing_ = false;
+
+  // drain only reports progress, its return value doesn't steer the parse
+  if (need_drain_ && queued_bytes_ < high_water_mark_) {
+    v8::HandleScope scope;
+    v8::Handle<v8::Value> argv[0];
+    need_drain_ = false;
+    Dispatch("drain", 0, argv);
+  }
+}
+
+v8::Handle<v8::Value>
+SaxParser::Threaded(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  if (args.Length() == 0)
+    return v8::Boolean::New(parser->threaded_);
+
+  parser->threaded_ = args[0]->ToBoolean()->Value();
+  return args.This();
+}
+
+// #filter() returns the paths, #filter(path), #filter([path, ...]) replaces
+// them and #filter(null) removes the filter again.
+v8::Handle<v8::Value>
+SaxParser::Filter(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  if (args.Length() == 0) {
+    const std::vector<std::string>& paths = parser->filter_.paths();
+    v8::Handle<v8::Array> list = v8::Array::New(paths.size());
+    for (unsigned int i = 0; i < paths.size(); i++)
+      list->Set(v8::Integer::New(i),
+                NewString(paths[i].data(), paths[i].size()));
+
+    return scope.Close(list);
+  }
+
+  parser->filter_.clear();
+
+  if (args[0]->IsNull() || args[0]->IsUndefined())
+    return args.This();
+
+  v8::Handle<v8::Array> paths;
+  if (args[0]->IsArray()) {
+    paths = v8::Handle<v8::Array>::Cast(args[0]);
+  } else {
+    paths = v8::Array::New(1);
+    paths->Set(v8::Integer::New(0), args[0]);
+  }
+
+  for (unsigned int i = 0; i < paths->Length(); i++) {
+    v8::String::Utf8Value path(paths->Get(v8::Integer::New(i)));
+    if (!parser->filter_.add(*path)) {
+      parser->filter_.clear();
+      return v8::ThrowException(v8::Exception::TypeError(
+        v8::String::New("Bad argument: invalid filter path")));
+    }
+  }
+
+  return args.This();
+}
+
+// #record(filename) writes the events of every following parse into a binary
+// log, #record(null) closes it.
+v8::Handle<v8::Value>
+SaxParser::Record(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  // a full disk shows up here at the latest, when the log is closed
+  bool written = !parser->recorder_ || parser->recorder_->close();
+  delete parser->recorder_;
+  parser->recorder_ = NULL;
+  if (!written)
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New(kLogWriteError)));
+
+  if (args[0]->IsNull() || args[0]->IsUndefined())
+    return args.This();
+
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsString,
+                               "Bad Argument: record requires a filename");
+
+  v8::String::Utf8Value filename(args[0]->ToString());
+  parser->recorder_ = SaxEventLogWriter::Open(*filename);
+  if (!parser->recorder_)
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to open the event log for writing")));
+
+  return args.This();
+}
+
+v8::Handle<v8::Value>
+SaxParser::ReplayFile(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                               IsString,
+                               "Bad Argument: replayFile requires a filename");
+
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  v8::String::Utf8Value filename(args[0]->ToString());
+  if (!parser->replay_file(*filename))
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New("Unable to replay the event log")));
+
+  return v8::Boolean::New(true);
+}
+
+// #stats() returns the counters, #stats(true) clears and enables them and
+// #stats(false) turns them off.
+v8::Handle<v8::Value>
+SaxParser::Stats(const v8::Arguments& args) {
+  v8::HandleScope scope;
+  SaxParser *parser = LibXmlObj::Unwrap<SaxParser>(args.Holder());
+
+  if (args.Length() > 0) {
+    parser->stats_enabled_ = args[0]->ToBoolean()->Value();
+    memset(&parser->stats_, 0, sizeof(parser->stats_));
+    return args.This();
+  }
+
+  if (!parser->stats_enabled_)
+    return v8::Null();
+
+  const ParseStats& stats = parser->stats_;
+  v8::Handle<v8::Object> events = v8::Object::New();
+  for (int i = 0; i <= SaxEvent::ERROR; i++)
+    events->Set(v8::String::NewSymbol(kEventNames[i]),
+                v8::Number::New(stats.events[i]));
+
+  v8::Handle<v8::Object> obj = v8::Object::New();
+  obj->Set(v8::String::NewSymbol("bytes"), v8::Number::New(stats.bytes));
+  obj->Set(v8::String::NewSymbol("events"), events);
+  obj->Set(v8::String::NewSymbol("characterBytes"),
+           v8::Number::New(stats.character_bytes));
+  obj->Set(v8::String::NewSymbol("callbacks"),
+           v8::Number::New(stats.callbacks));
+  obj->Set(v8::String::NewSymbol("jsTime"), v8::Number::New(stats.js_ns));
+  obj->Set(v8::String::NewSymbol("nativeTime"),
+           v8::Number::New(stats.native_ns));
+
+  return scope.Close(obj);
+}
+
+void
+SaxParser::account_native_time(uint64_t start,
+                               uint64_t js_start) {
+  stats_.native_ns += (now_ns() - start) - (stats_.js_ns - js_start);
 }
 
 v8::Handle<v8::Value>
@@ -170,6 +612,9 @@ SaxParser::ParseString(const v8::Arguments& args) {
 
   v8::String::Utf8Value parsable(args[0]->ToString());
   parser->parse_string(*parsable, parsable.length());
+  if (parser->recorder_ && parser->recorder_->failed())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New(kLogWriteError)));
 
   // TODO(sprsquish): return based on the parser
   return v8::Boolean::New(true);
@@ -177,10 +622,19 @@ SaxParser::ParseString(const v8::Arguments& args) {
 
 void
 SaxParser::parse_string(const char* str, unsigned int size) {
+  uint64_t start = stats_enabled_ ? now_ns() : 0, js_start = stats_.js_ns;
+
   context_ = xmlCreateMemoryParserCtxt(str, size);
   parse();
+
+  if (stats_enabled_) {
+    account_native_time(start, js_start);
+    stats_.bytes += size;
+  }
+
   context_->sax = NULL;
   xmlFreeParserCtxt(context_);
+  context_ = NULL;
 }
 
 v8::Handle<v8::Value>
@@ -194,6 +648,9 @@ SaxParser::ParseFile(const v8::Arguments& args) {
 
   v8::String::Utf8Value parsable(args[0]->ToString());
   parser->parse_file(*parsable);
+  if (parser->recorder_ && parser->recorder_->failed())
+    return v8::ThrowException(v8::Exception::Error(
+      v8::String::New(kLogWriteError)));
 
   // TODO(sprsquish): return based on the parser
   return v8::Boolean::New(true);
@@ -201,26 +658,167 @@ SaxParser::ParseFile(const v8::Arguments& args) {
 
 void
 SaxParser::parse_file(const char* filename) {
+  uint64_t start = stats_enabled_ ? now_ns() : 0, js_start = stats_.js_ns;
+
   context_ = xmlCreateFileParserCtxt(filename);
   parse();
+
+  if (stats_enabled_) {
+    account_native_time(start, js_start);
+    stats_.bytes += xmlByteConsumed(context_);
+  }
+
   context_->sax = NULL;
   xmlFreeParserCtxt(context_);
+  context_ = NULL;
+}
+
+// Hands the events of a log written by #record to the callbacks again,
+// without tokenizing or checking the document.
+bool
+SaxParser::replay_file(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  uint64_t start = stats_enabled_ ? now_ns() : 0, js_start = stats_.js_ns;
+
+  reset_state();
+  SaxEventLogReader reader(static_cast<const char*>(data), info.st_size);
+  bool replayed = reader.replay(this);
+
+  if (stats_enabled_) {
+    account_native_time(start, js_start);
+    stats_.bytes += info.st_size;
+  }
+
+  munmap(data, info.st_size);
+  return replayed;
 }
 
 void
 SaxParser::parse() {
   initializeContext();
+
+  if (threaded_) {
+    parse_threaded();
+    return;
+  }
+
   context_->sax = sax_handler_;
   xmlParseDocument(context_);
 }
 
+// libxml2 tokenizes on a parse thread and fills the event queue while this
+// thread hands the events to JS, so parsing and the callbacks overlap.
+void
+SaxParser::parse_threaded() {
+  SaxEventQueue queue(context_);
+  context_->_private = &queue;
+  context_->sax = SaxEventQueue::sax_handler();
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, SaxEventQueue::Run, &queue) != 0) {
+    context_->_private = this;
+    context_->sax = sax_handler_;
+    xmlParseDocument(context_);
+    return;
+  }
+
+  queue_ = &queue;
+  dispatch(&queue);
+  pthread_join(thread, NULL);
+  queue_ = NULL;
+  context_->_private = this;
+}
+
+void
+SaxParser::dispatch(SaxEventQueue* queue) {
+  SaxEvent* event;
+  while ((event = queue->next())) {
+    switch (event->type) {
+      case SaxEvent::START_DOCUMENT:
+        start_document();
+        break;
+
+      case SaxEvent::END_DOCUMENT:
+        end_document();
+        break;
+
+      case SaxEvent::START_ELEMENT_NS:
+        start_element_ns(event->value,
+                         event->prefix,
+                         event->uri,
+                         event->nb_namespaces,
+                         event->namespaces,
+                         event->nb_attributes,
+                         0,
+                         event->attributes);
+        break;
+
+      case SaxEvent::END_ELEMENT_NS:
+        end_element_ns(event->value, event->prefix, event->uri);
+        break;
+
+      case SaxEvent::CHARACTERS:
+        characters(event->value, event->len);
+        break;
+
+      case SaxEvent::COMMENT:
+        comment(event->value);
+        break;
+
+      case SaxEvent::CDATA_BLOCK:
+        cdata_block(event->value, event->len);
+        break;
+
+      case SaxEvent::WARNING:
+        warning((const char*)event->value);
+        break;
+
+      case SaxEvent::ERROR:
+        error((const char*)event->value);
+        break;
+    }
+    queue->pop();
+  }
+}
+
 void
 SaxParser::start_document() {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::START_DOCUMENT);
+
+  if (recorder_)
+    recorder_->start_document();
+
+  filter_.reset();
   Callback("startDocument");
 }
 
 void
 SaxParser::end_document() {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::END_DOCUMENT);
+
+  if (recorder_)
+    recorder_->end_document();
+
   Callback("endDocument");
 }
 
@@ -233,6 +831,27 @@ SaxParser::start_element_ns(const xmlChar* localname,
                             int nb_attributes,
                             int nb_defaulted,
                             const xmlChar** attributes) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::START_ELEMENT_NS);
+
+  if (recorder_)
+    recorder_->start_element_ns(localname,
+                                prefix,
+                                uri,
+                                nb_namespaces,
+                                namespaces,
+                                nb_attributes,
+                                attributes);
+
+  depth_++;
+  if (skip_depth_)
+    return;
+
+  if (!filter_.empty() && !filter_.start_element(localname, prefix))
+    return;
+
   v8::HandleScope scope;
 
   const int argc = 5;
@@ -243,7 +862,7 @@ SaxParser::start_element_ns(const xmlChar* localname,
 
   // Initialize argv with localname, prefix, and uri
   v8::Handle<v8::Value> argv[argc] = {
-    v8::String::New((const char*)localname)
+    NewString(localname)
   };
 
   // Build attributes list
@@ -259,24 +878,24 @@ SaxParser::start_element_ns(const xmlChar* localname,
       elem = v8::Array::New(4);
 
       elem->Set(v8::Integer::New(0),
-                v8::String::New((const char*)attrLocal, xmlStrlen(attrLocal)));
+                NewString(attrLocal, xmlStrlen(attrLocal)));
 
       elem->Set(v8::Integer::New(1),
-                v8::String::New((const char*)attrPref, xmlStrlen(attrPref)));
+                NewString(attrPref, xmlStrlen(attrPref)));
 
       elem->Set(v8::Integer::New(2),
-                v8::String::New((const char*)attrUri, xmlStrlen(attrUri)));
+                NewString(attrUri, xmlStrlen(attrUri)));
 
       elem->Set(v8::Integer::New(3),
-                v8::String::New((const char*)attrVal, attributes[i+4]-attrVal));
+                NewString(attrVal, attributes[i+4]-attrVal));
 
       attrList->Set(v8::Integer::New(j), elem);
     }
   }
   argv[1] = attrList;
 
-  argv[2] = prefix ? v8::String::New((const char*)prefix) : v8::Null();
-  argv[3] = uri ? v8::String::New((const char*)uri) : v8::Null();
+  argv[2] = prefix ? NewString(prefix) : v8::Null();
+  argv[3] = uri ? NewString(uri) : v8::Null();
 
   // Build namespace array of arrays [[prefix, ns], [prefix, ns]]
   v8::Local<v8::Array> nsList = v8::Array::New(nb_namespaces);
@@ -288,11 +907,10 @@ SaxParser::start_element_ns(const xmlChar* localname,
       elem = v8::Array::New(2);
       elem->Set(v8::Integer::New(0),
                 xmlStrlen(nsPref) == 0 ? v8::Null() :
-                v8::String::New((const char *)nsPref, xmlStrlen(nsPref)));
+                NewString(nsPref, xmlStrlen(nsPref)));
 
       elem->Set(v8::Integer::New(1),
-                v8::String::New((const char *)nsUri,
-                xmlStrlen(nsUri)));
+                NewString(nsUri, xmlStrlen(nsUri)));
 
       nsList->Set(v8::Integer::New(j), elem);
     }
@@ -306,12 +924,31 @@ void
 SaxParser::end_element_ns(const xmlChar* localname,
                           const xmlChar* prefix,
                           const xmlChar* uri) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::END_ELEMENT_NS);
+
+  if (recorder_)
+    recorder_->end_element_ns(localname, prefix, uri);
+
+  // the end tag of a skipped element is still delivered
+  int depth = depth_--;
+  if (skip_depth_) {
+    if (depth > skip_depth_)
+      return;
+    skip_depth_ = 0;
+  }
+
+  if (!filter_.empty() && !filter_.end_element())
+    return;
+
   v8::HandleScope scope;
 
   v8::Handle<v8::Value> argv[3] = {
-    v8::String::New((const char*)localname),
-    prefix ? v8::String::New((const char*)prefix) : v8::Null(),
-    uri ? v8::String::New((const char*)uri) : v8::Null()
+    NewString(localname),
+    prefix ? NewString(prefix) : v8::Null(),
+    uri ? NewString(uri) : v8::Null()
   };
 
   Callback("endElementNS", 3, argv);
@@ -320,38 +957,98 @@ SaxParser::end_element_ns(const xmlChar* localname,
 void
 SaxParser::characters(const xmlChar* ch,
                       int len) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::CHARACTERS);
+  if (stats_enabled_)
+    stats_.character_bytes += len;
+
+  if (recorder_)
+    recorder_->text(SaxEventLog::CHARACTERS, ch, len);
+
+  if (skip_depth_)
+    return;
+
+  if (!filter_.empty() && !filter_.in_match())
+    return;
+
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[1] = { v8::String::New((const char*)ch, len) };
+  v8::Handle<v8::Value> argv[1] = { NewString(ch, len) };
   Callback("characters", 1, argv);
 }
 
 void
 SaxParser::comment(const xmlChar* value) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::COMMENT);
+
+  if (recorder_)
+    recorder_->text(SaxEventLog::COMMENT, value, -1);
+
+  if (skip_depth_)
+    return;
+
+  if (!filter_.empty() && !filter_.in_match())
+    return;
+
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[1] = { v8::String::New((const char*)value) };
+  v8::Handle<v8::Value> argv[1] = { NewString(value) };
   Callback("comment", 1, argv);
 }
 
 void
 SaxParser::cdata_block(const xmlChar* value,
                        int len) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::CDATA_BLOCK);
+
+  if (recorder_)
+    recorder_->text(SaxEventLog::CDATA_BLOCK, value, len);
+
+  if (skip_depth_)
+    return;
+
+  if (!filter_.empty() && !filter_.in_match())
+    return;
+
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[1] = { v8::String::New((const char*)value, len) };
+  v8::Handle<v8::Value> argv[1] = { NewString(value, len) };
   Callback("cdata", 1, argv);
 }
 
 void
 SaxParser::warning(const char* message) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::WARNING);
+
+  if (recorder_)
+    recorder_->text(SaxEventLog::WARNING, (const xmlChar*)message, -1);
+
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[1] = { v8::String::New((const char*)message) };
+  v8::Handle<v8::Value> argv[1] = { NewString(message) };
   Callback("warning", 1, argv);
 }
 
 
 void
 SaxParser::error(const char* message) {
+  if (stopped_)
+    return;
+
+  count_event(SaxEvent::ERROR);
+
+  if (recorder_)
+    recorder_->text(SaxEventLog::ERROR, (const xmlChar*)message, -1);
+
   v8::HandleScope scope;
-  v8::Handle<v8::Value> argv[1] = { v8::String::New((const char*)message) };
+  v8::Handle<v8::Value> argv[1] = { NewString(message) };
   Callback("error", 1, argv);
 }
 
@@ -494,8 +1191,44 @@ SaxParser::Initialize(v8::Handle<v8::Object> target) {
                         "parseFile",
                         SaxParser::ParseFile);
 
-  target->Set(v8::String::NewSymbol("SaxParser"),
-              sax_parser_template->GetFunction());
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "threaded",
+                        SaxParser::Threaded);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "filter",
+                        SaxParser::Filter);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "skipSubtree",
+                        SaxParser::SkipSubtree);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "stop",
+                        SaxParser::Stop);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "record",
+                        SaxParser::Record);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "stats",
+                        SaxParser::Stats);
+
+  LXJS_SET_PROTO_METHOD(sax_parser_template,
+                        "replayFile",
+                        SaxParser::ReplayFile);
+
+  skip_subtree_control = v8::Persistent<v8::Object>::New(v8::Object::New());
+  stop_control = v8::Persistent<v8::Object>::New(v8::Object::New());
+
+  v8::Handle<v8::Function> sax_parser = sax_parser_template->GetFunction();
+  sax_parser->Set(v8::String::NewSymbol("SKIP_SUBTREE"),
+                  skip_subtree_control);
+  sax_parser->Set(v8::String::NewSymbol("STOP"),
+                  stop_control);
+
+  target->Set(v8::String::NewSymbol("SaxParser"), sax_parser);
 
 
   v8::Local<v8::FunctionTemplate> push_parser_t =
@@ -511,7 +1244,49 @@ SaxParser::Initialize(v8::Handle<v8::Object> target) {
                         "push",
                         SaxParser::Push);
 
-  target->Set(v8::String::NewSymbol("SaxPushParser"),
-              sax_push_parser_template->GetFunction());
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "reset",
+                        SaxParser::Reset);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "pause",
+                        SaxParser::Pause);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "resume",
+                        SaxParser::Resume);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "highWaterMark",
+                        SaxParser::HighWaterMark);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "filter",
+                        SaxParser::Filter);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "skipSubtree",
+                        SaxParser::SkipSubtree);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "stop",
+                        SaxParser::Stop);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "record",
+                        SaxParser::Record);
+
+  LXJS_SET_PROTO_METHOD(sax_push_parser_template,
+                        "stats",
+                        SaxParser::Stats);
+
+  v8::Handle<v8::Function> sax_push_parser =
+    sax_push_parser_template->GetFunction();
+  sax_push_parser->Set(v8::String::NewSymbol("SKIP_SUBTREE"),
+                       skip_subtree_control);
+  sax_push_parser->Set(v8::String::NewSymbol("STOP"),
+                       stop_control);
+
+  target->Set(v8::String::NewSymbol("SaxPushParser"), sax_push_parser);
 }
 }  // namespace libxmljs
@@ -4,10 +4,17 @@
 
 #include <v8.h>
 
+#include <stdint.h>
+
+#include <deque>
 #include <memory>
+#include <string>
 
 #include "./libxmljs.h"
 #include "./parser.h"
+#include "./sax_event_log.h"
+#include "./sax_event_queue.h"
+#include "./sax_path_filter.h"
 
 
 namespace libxmljs {
@@ -22,6 +29,7 @@ class SaxParser : public Parser {
   public:
 
   SaxParser();
+  virtual ~SaxParser();
 
   static void
   Initialize(v8::Handle<v8::Object> target);
@@ -41,6 +49,39 @@ class SaxParser : public Parser {
   static v8::Handle<v8::Value>
   Push(const v8::Arguments& args);
 
+  static v8::Handle<v8::Value>
+  Threaded(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Reset(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Pause(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Resume(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  HighWaterMark(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Filter(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  SkipSubtree(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Record(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Stats(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  ReplayFile(const v8::Arguments& args);
+
+  static v8::Handle<v8::Value>
+  Stop(const v8::Arguments& args);
+
   void
   SetCallbacks(const v8::Handle<v8::Object> context,
                const v8::Handle<v8::Function> callbacks);
@@ -53,6 +94,25 @@ class SaxParser : public Parser {
            int argc,
            v8::Handle<v8::Value> argv[]);
 
+  // Calls the JS callbacks for |what| and returns what they returned,
+  // without letting it steer the parse.
+  v8::Handle<v8::Value>
+  Dispatch(const char* what,
+           int argc,
+           v8::Handle<v8::Value> argv[]);
+
+  // SaxParser.SKIP_SUBTREE and SaxParser.STOP. Callbacks steer the parse by
+  // returning one of these objects; they are matched by identity so that an
+  // ordinary return value, like the length from names.push(), does nothing.
+  static v8::Persistent<v8::Object> skip_subtree_control;
+  static v8::Persistent<v8::Object> stop_control;
+
+  void
+  skip_subtree();
+
+  void
+  stop();
+
   void
   parse_string(const char* str,
                unsigned int size);
@@ -60,14 +120,33 @@ class SaxParser : public Parser {
   void
   parse_file(const char* filename);
 
+  bool
+  replay_file(const char* filename);
+
   void
   initialize_push_parser();
 
+  void
+  reset_push_parser();
+
   void
   push(const char* str,
        unsigned int size,
        bool terminate);
 
+  void
+  push_chunk(const char* str,
+             size_t size,
+             bool terminate);
+
+  void
+  enqueue(const char* str,
+          size_t size,
+          bool terminate);
+
+  void
+  process_queue();
+
   void
   start_document();
 
@@ -128,10 +207,65 @@ class SaxParser : public Parser {
   v8::Persistent<v8::Object> callbacks_;
   _xmlSAXHandler* sax_handler_;
 
+  // parse on a separate thread and dispatch the queued events from this one
+  bool threaded_;
+
+  // Chunks handed to the push parser that have not been parsed yet.
+  struct PushChunk {
+    std::string data;
+    bool terminate;
+  };
+
+  std::deque<PushChunk> push_queue_;
+  size_t queued_bytes_;
+  size_t high_water_mark_;
+  bool paused_;
+  bool processing_;
+  bool reset_pending_;  // reset() was called from a callback mid-chunk
+  bool need_drain_;
+
+  // only element events inside subtrees matching these paths reach JS
+  SaxPathFilter filter_;
+
+  SaxEventQueue* queue_;  // set while a threaded parse is running
+  int depth_;
+  int skip_depth_;  // depth of the element being skipped, 0 for none
+  bool stopped_;
+
+  SaxEventLogWriter* recorder_;  // copies every event into a log when set
+
+  // Counters for #stats(). Time is in nanoseconds; native time is the part of
+  // a parse call that was not spent inside JS callbacks.
+  struct ParseStats {
+    uint64_t bytes;
+    uint64_t events[SaxEvent::ERROR + 1];
+    uint64_t character_bytes;
+    uint64_t callbacks;
+    uint64_t js_ns;
+    uint64_t native_ns;
+  };
+
+  bool stats_enabled_;
+  ParseStats stats_;
+
+  inline void
+  count_event(SaxEvent::Type type) {
+    if (stats_enabled_)
+      stats_.events[type]++;
+  }
+
+  void
+  account_native_time(uint64_t start,
+                      uint64_t js_start);
+
   private:
 
   friend struct SaxParserCallback;
+  friend class SaxEventLogReader;
+  void reset_state();
   void parse();
+  void parse_threaded();
+  void dispatch(SaxEventQueue* queue);
 };
 
 struct SaxParserCallback {
@@ -8,8 +8,12 @@ libxml.SaxCallbacks = function() {
       callbackList[name].push(callback);
   };
 
+  // Returns the first value a callback returned so they can steer the
+  // parser with SaxParser.SKIP_SUBTREE or SaxParser.STOP. Only those two
+  // objects steer it, any other return value is ignored.
   this.callback = function() {
     var name = arguments[0];
+    var callback, control, ret, i;
     if (!(callback = callbackList[name]))
       return;
 
@@ -17,8 +21,13 @@ libxml.SaxCallbacks = function() {
     for (i = 1; i < arguments.length; i++)
       args.push(arguments[i]);
 
-    for (i = 0; i < callback.length; i++)
-      callback[i].apply(callback, args);
+    for (i = 0; i < callback.length; i++) {
+      ret = callback[i].apply(callback, args);
+      if (control === undefined)
+        control = ret;
+    }
+
+    return control;
   };
 
   this.onStartDocument = function(callback) {
@@ -57,6 +66,10 @@ libxml.SaxCallbacks = function() {
     addCallback('error', callback);
   };
 
+  this.onDrain = function(callback) {
+    addCallback('drain', callback);
+  };
+
   return this;
 };
 
@@ -0,0 +1,139 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./sax_path_filter.h"
+
+namespace libxmljs {
+
+SaxPathFilter::SaxPathFilter() : match_depth_(0) {
+}
+
+bool
+SaxPathFilter::add(const char* source) {
+  Path path;
+  std::string str(source);
+  size_t pos = 0;
+
+  // relative paths match anywhere in the document
+  bool descendant = str.compare(0, 1, "/") != 0;
+
+  while (pos < str.size()) {
+    if (str[pos] == '/') {
+      if (pos + 1 < str.size() && str[pos + 1] == '/') {
+        descendant = true;
+        pos += 2;
+      } else {
+        pos += 1;
+      }
+    }
+
+    size_t end = str.find('/', pos);
+    if (end == std::string::npos)
+      end = str.size();
+
+    if (end == pos)
+      return false;
+
+    Step step;
+    step.name = str.substr(pos, end - pos);
+    step.descendant = descendant;
+    path.push_back(step);
+
+    descendant = false;
+    pos = end;
+  }
+
+  if (path.empty())
+    return false;
+
+  paths_.push_back(path);
+  sources_.push_back(str);
+  return true;
+}
+
+void
+SaxPathFilter::clear() {
+  paths_.clear();
+  sources_.clear();
+  reset();
+}
+
+void
+SaxPathFilter::reset() {
+  stack_.clear();
+  match_depth_ = 0;
+}
+
+bool
+SaxPathFilter::start_element(const xmlChar* localname,
+                             const xmlChar* prefix) {
+  Entry entry;
+  entry.localname = (const char*)localname;
+  if (prefix) {
+    entry.qname = (const char*)prefix;
+    entry.qname += ':';
+  }
+  entry.qname += entry.localname;
+  stack_.push_back(entry);
+
+  if (match_depth_)
+    return true;
+
+  for (size_t i = 0; i < paths_.size(); i++) {
+    if (matches(paths_[i], 0, 0)) {
+      match_depth_ = stack_.size();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+SaxPathFilter::end_element() {
+  bool deliver = match_depth_ > 0;
+
+  if (match_depth_ == stack_.size())
+    match_depth_ = 0;
+
+  if (!stack_.empty())
+    stack_.pop_back();
+
+  return deliver;
+}
+
+// Paths are only checked as each element opens, so the last step always has
+// to match the element on top of the stack.
+bool
+SaxPathFilter::matches(const Path& path,
+                       size_t step,
+                       size_t depth) const {
+  if (step == path.size())
+    return depth == stack_.size();
+
+  if (depth == stack_.size())
+    return false;
+
+  if (!path[step].descendant)
+    return name_matches(path[step], stack_[depth]) &&
+           matches(path, step + 1, depth + 1);
+
+  for (size_t i = depth; i < stack_.size(); i++) {
+    if (name_matches(path[step], stack_[i]) && matches(path, step + 1, i + 1))
+      return true;
+  }
+
+  return false;
+}
+
+bool
+SaxPathFilter::name_matches(const Step& step,
+                            const Entry& entry) const {
+  if (step.name == "*")
+    return true;
+
+  if (step.name.find(':') != std::string::npos)
+    return step.name == entry.qname;
+
+  return step.name == entry.localname;
+}
+
+}  // namespace libxmljs
@@ -0,0 +1,67 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SAX_PATH_FILTER_H_
+#define SRC_SAX_PATH_FILTER_H_
+
+#include <libxml/xmlstring.h>
+
+#include <string>
+#include <vector>
+
+namespace libxmljs {
+
+// Tracks the open element stack of a SAX parse and decides whether events
+// fall inside a subtree selected by one of a set of simple paths:
+//
+//   /feed/entry/title  child steps from the document root
+//   //price            descendant step, matches at any depth
+//   /feed//link/*      steps can be mixed, * matches any element
+//
+// Steps with a prefix (atom:title) match the qualified name, steps without
+// one match the local name.
+class SaxPathFilter {
+  public:
+
+  SaxPathFilter();
+
+  bool add(const char* path);
+  void clear();
+  void reset();
+  bool empty() const { return paths_.empty(); }
+
+  const std::vector<std::string>& paths() const { return sources_; }
+
+  // Return true when the event should be delivered.
+  bool start_element(const xmlChar* localname, const xmlChar* prefix);
+  bool end_element();
+  bool in_match() const { return match_depth_ > 0; }
+
+  private:
+
+  struct Step {
+    std::string name;
+    bool descendant;
+  };
+
+  struct Entry {
+    std::string localname;
+    std::string qname;
+  };
+
+  typedef std::vector<Step> Path;
+
+  bool matches(const Path& path,
+               size_t step,
+               size_t depth) const;
+
+  bool name_matches(const Step& step,
+                    const Entry& entry) const;
+
+  std::vector<Path> paths_;
+  std::vector<std::string> sources_;
+  std::vector<Entry> stack_;
+  size_t match_depth_;  // depth of the matched subtree's root, 0 for none
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SAX_PATH_FILTER_H_
@@ -0,0 +1,194 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./serialize_job.h"
+
+#include <libxml/xmlIO.h>
+#include <libxml/xmlsave.h>
+
+#include <deque>
+
+namespace libxmljs {
+
+namespace {
+
+// Workers are started as jobs arrive, up to this many, and then live for
+// the rest of the process.
+const int kMaxWorkers = 4;
+
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t job_queued = PTHREAD_COND_INITIALIZER;
+pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+std::deque<SerializeJob*> pending_jobs;
+int workers = 0;
+int idle_workers = 0;
+
+// xmlSaveToIO sink forwarding to an xmlOutputBuffer, which takes care of
+// the file or descriptor and of gzip compression. xmlOutputBufferWrite
+// returns 0 when it only buffered the data; the save context would hand
+// those bytes over again, so report them as taken.
+int
+write_output(void* context, const char* data, int len) {
+  if (xmlOutputBufferWrite(static_cast<xmlOutputBuffer*>(context),
+                           len, data) < 0)
+    return -1;
+  return len;
+}
+
+}  // namespace
+
+SerializeJob::SerializeJob(xmlDoc* doc, const SaveOptions& options)
+  : doc_(doc),
+    options_(options),
+    fd_(-1),
+    written_(0),
+    error_(NULL),
+    started_(false),
+    done_(0) {
+}
+
+SerializeJob::~SerializeJob() {
+  wait();
+}
+
+void
+SerializeJob::run() {
+  xmlOutputBuffer* output = NULL;
+  xmlCharEncodingHandler* encoder = options_.encoder();
+
+  if (!has_target()) {
+    output_.reserve(options_.chunk_size);
+    output = xmlOutputBufferCreateIO(append_output, NULL, this, encoder);
+  } else if (!path_.empty()) {
+    output = xmlOutputBufferCreateFilename(path_.c_str(),
+                                           encoder,
+                                           options_.compression);
+  } else {
+    // the descriptor is left open for the caller
+    output = xmlOutputBufferCreateFd(fd_, encoder);
+  }
+
+  if (!output) {
+    if (encoder)
+      xmlCharEncCloseFunc(encoder);
+    error_ = "Unable to open file for writing";
+    return;
+  }
+
+  int saved = Write(doc_, options_, output);
+
+  // every byte that went through the output buffer, before compression
+  written_ = xmlOutputBufferClose(output);
+  if (saved < 0 || written_ < 0)
+    error_ = "Unable to write document";
+}
+
+int
+SerializeJob::Write(xmlDoc* doc,
+                    const SaveOptions& options,
+                    xmlOutputBuffer* output) {
+  // Written here, the save context only knows the document's own encoding.
+  // HTML documents come out as XML, as they always have from toString().
+  if (options.declaration) {
+    xmlOutputBufferWriteString(output, "<?xml version=\"");
+    xmlOutputBufferWriteString(output, doc->version
+      ? reinterpret_cast<const char*>(doc->version) : "1.0");
+    xmlOutputBufferWriteString(output, "\" encoding=\"");
+    xmlOutputBufferWriteString(output, options.encoding.c_str());
+    xmlOutputBufferWriteString(output, "\"");
+    if (doc->standalone == 1)
+      xmlOutputBufferWriteString(output, " standalone=\"yes\"");
+    else if (doc->standalone == 0)
+      xmlOutputBufferWriteString(output, " standalone=\"no\"");
+    xmlOutputBufferWriteString(output, "?>\n");
+  }
+
+  xmlSaveCtxt* context = xmlSaveToIO(write_output,
+                                     NULL,
+                                     output,
+                                     NULL,
+                                     options.flags() | XML_SAVE_NO_DECL |
+                                       XML_SAVE_AS_XML);
+  if (!context)
+    return -1;
+
+  // leave non-ASCII text to the output buffer's encoder instead of
+  // turning it into character references
+  xmlSaveSetEscape(context, NULL);
+
+  xmlSaveDoc(context, doc);
+  if (xmlSaveClose(context) < 0 || output->error)
+    return -1;
+
+  return 0;
+}
+
+bool
+SerializeJob::start() {
+  pthread_mutex_lock(&pool_lock);
+
+  if (idle_workers == 0 && workers < kMaxWorkers) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, Work, NULL) == 0) {
+      pthread_detach(thread);
+      ++workers;
+    }
+  }
+
+  started_ = workers > 0;
+  if (started_) {
+    pending_jobs.push_back(this);
+    pthread_cond_signal(&job_queued);
+  }
+
+  pthread_mutex_unlock(&pool_lock);
+  return started_;
+}
+
+bool
+SerializeJob::done() const {
+  return __atomic_load_n(&done_, __ATOMIC_ACQUIRE);
+}
+
+void
+SerializeJob::wait() {
+  if (!started_)
+    return;
+
+  pthread_mutex_lock(&pool_lock);
+  while (!done_)
+    pthread_cond_wait(&job_done, &pool_lock);
+  pthread_mutex_unlock(&pool_lock);
+
+  started_ = false;
+}
+
+void*
+SerializeJob::Work(void* unused) {
+  pthread_mutex_lock(&pool_lock);
+
+  for (;;) {
+    ++idle_workers;
+    while (pending_jobs.empty())
+      pthread_cond_wait(&job_queued, &pool_lock);
+    --idle_workers;
+
+    SerializeJob* job = pending_jobs.front();
+    pending_jobs.pop_front();
+    pthread_mutex_unlock(&pool_lock);
+
+    job->run();
+
+    pthread_mutex_lock(&pool_lock);
+    __atomic_store_n(&job->done_, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&job_done);
+  }
+
+  return NULL;
+}
+
+int
+SerializeJob::append_output(void* data, const char* buffer, int len) {
+  static_cast<SerializeJob*>(data)->output_.append(buffer, len);
+  return len;
+}
+
+}  // namespace libxmljs
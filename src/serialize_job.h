@@ -0,0 +1,76 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SERIALIZE_JOB_H_
+#define SRC_SERIALIZE_JOB_H_
+
+#include <libxml/tree.h>
+#include <libxml/xmlIO.h>
+
+#include <pthread.h>
+
+#include <string>
+
+#include "./save_options.h"
+
+namespace libxmljs {
+
+// Serializes a document into memory or to a file, either on the calling
+// thread with run() or on a small shared pool of worker threads with start().
+// The tree must not change until the job is done; Document keeps itself
+// read-only meanwhile.
+class SerializeJob {
+  public:
+
+  SerializeJob(xmlDoc* doc, const SaveOptions& options);
+  ~SerializeJob();
+
+  // write to a file or descriptor instead of into output()
+  void set_path(const std::string& path) { path_ = path; }
+  void set_fd(int fd) { fd_ = fd; }
+  bool has_target() const { return !path_.empty() || fd_ >= 0; }
+
+  void run();
+
+  // Writes doc into output, which does any encoding, and returns -1 on
+  // error. Handing the encoding to xmlSaveToIO instead would have libxml2
+  // swap it into doc->encoding for the duration, racing with other readers.
+  static int Write(xmlDoc* doc,
+                   const SaveOptions& options,
+                   xmlOutputBuffer* output);
+
+  // Queues the job for the pool. false if no worker could be created.
+  bool start();
+  bool done() const;
+
+  // waits for a started job
+  void wait();
+
+  // NULL on success
+  const char* error() const { return error_; }
+  const std::string& output() const { return output_; }
+
+  // bytes serialized, before any compression
+  int written() const { return written_; }
+
+  private:
+
+  // worker thread entry point
+  static void* Work(void* unused);
+
+  static int append_output(void* job, const char* data, int len);
+
+  xmlDoc* doc_;
+  SaveOptions options_;
+  std::string path_;
+  int fd_;
+
+  std::string output_;
+  int written_;
+  const char* error_;
+
+  bool started_;
+  int done_;
+};
+
+}  // namespace libxmljs
+
+#endif  // SRC_SERIALIZE_JOB_H_
@@ -0,0 +1,90 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_SLAB_POOL_H_
+#define SRC_SLAB_POOL_H_
+
+#include <stddef.h>
+
+#include <new>
+
+namespace libxmljs {
+
+// Fixed size allocator for node wrappers. Slots are carved out of slabs of
+// kSlabObjects and collected wrappers go back on a free list to be reused by
+// the next one built. Wrappers are only created and collected on the JS
+// thread, so the pool takes no locks.
+//
+// A class opts in by routing its operator new/delete here:
+//
+//   static void* operator new(size_t size) {
+//     return SlabPool<Element>::Allocate(size);
+//   }
+//   static void operator delete(void* ptr, size_t size) {
+//     SlabPool<Element>::Free(ptr, size);
+//   }
+template <class T>
+class SlabPool {
+  public:
+
+  static void*
+  Allocate(size_t size) {
+    // subclasses without a pool of their own
+    if (size != sizeof(T))
+      return ::operator new(size);
+
+    if (!free_list_)
+      grow();
+
+    Slot* slot = free_list_;
+    free_list_ = slot->next;
+    return slot;
+  }
+
+  static void
+  Free(void* ptr, size_t size) {
+    if (!ptr)
+      return;
+
+    if (size != sizeof(T)) {
+      ::operator delete(ptr);
+      return;
+    }
+
+    Slot* slot = static_cast<Slot*>(ptr);
+    slot->next = free_list_;
+    free_list_ = slot;
+  }
+
+  private:
+
+  static const size_t kSlabObjects = 256;
+
+  union Slot {
+    Slot* next;
+    double align_double;
+    void* align_pointer;
+    char data[sizeof(T)];
+  };
+
+  // Slabs live for the rest of the process; a traversal that needed this
+  // many wrappers once will likely need them again.
+  static void
+  grow() {
+    Slot* slab = static_cast<Slot*>(
+      ::operator new(sizeof(Slot) * kSlabObjects));
+
+    for (size_t i = 0; i < kSlabObjects - 1; ++i)
+      slab[i].next = &slab[i + 1];
+    slab[kSlabObjects - 1].next = free_list_;
+
+    free_list_ = slab;
+  }
+
+  static Slot* free_list_;
+};
+
+template <class T>
+typename SlabPool<T>::Slot* SlabPool<T>::free_list_ = NULL;
+
+}  // namespace libxmljs
+
+#endif  // SRC_SLAB_POOL_H_
@@ -0,0 +1,121 @@
+// Copyright 2009, Squish Tech, LLC.
+#include "./xml_string.h"
+
+#include <libxml/xmlmemory.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "./libxmljs.h"
+
+namespace libxmljs {
+
+namespace {
+
+size_t external_string_threshold = 64 * 1024;
+
+// Backs an external string with a buffer from xmlMalloc. V8 deletes the
+// resource once the string is collected.
+class XmlStringResource : public v8::String::ExternalAsciiStringResource {
+  public:
+
+  XmlStringResource(xmlChar* data, size_t length)
+    : data_(data), length_(length) {
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(static_cast<int>(length_));
+  }
+
+  virtual ~XmlStringResource() {
+    xmlFree(data_);
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(-static_cast<int>(length_));
+  }
+
+  virtual const char* data() const {
+    return reinterpret_cast<const char*>(data_);
+  }
+
+  virtual size_t length() const { return length_; }
+
+  private:
+
+  xmlChar* data_;
+  size_t length_;
+};
+
+}  // namespace
+
+bool
+IsAscii(const char* str, size_t len) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(str);
+  const unsigned char* end = p + len;
+
+#ifdef __SSE2__
+  // 16 bytes at a time, movemask collects the high bits
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (_mm_movemask_epi8(chunk))
+      return false;
+  }
+#else
+  for (; end - p >= 8; p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    if (word & 0x8080808080808080ULL)
+      return false;
+  }
+#endif
+
+  for (; p < end; ++p) {
+    if (*p & 0x80)
+      return false;
+  }
+  return true;
+}
+
+v8::Local<v8::String>
+NewString(const char* str, int len) {
+  if (len < 0)
+    len = strlen(str);
+
+  return v8::String::New(str, len);
+}
+
+v8::Handle<v8::String>
+AdoptXmlString(xmlChar* str, int len) {
+  v8::HandleScope scope;
+  if (len < 0)
+    len = xmlStrlen(str);
+
+  size_t length = static_cast<size_t>(len);
+
+  // the memory adjustment for an external string is passed as an int
+  if (external_string_threshold && length >= external_string_threshold &&
+      length <= INT_MAX && IsAscii((const char*)str, length))
+    return scope.Close(
+      v8::String::NewExternal(new XmlStringResource(str, length)));
+
+  v8::Local<v8::String> copy = NewString(str, len);
+  xmlFree(str);
+  return scope.Close(copy);
+}
+
+v8::Handle<v8::Value>
+ExternalStringThreshold(const v8::Arguments& args) {
+  v8::HandleScope scope;
+
+  if (args.Length() > 0) {
+    LIBXMLJS_ARGUMENT_TYPE_CHECK(args[0],
+                                 IsNumber,
+                                 "Bad argument: threshold must be a number");
+    double bytes = args[0]->NumberValue();
+    external_string_threshold = bytes > 0 ? static_cast<size_t>(bytes) : 0;
+  }
+
+  return scope.Close(v8::Number::New(external_string_threshold));
+}
+
+}  // namespace libxmljs
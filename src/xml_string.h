@@ -0,0 +1,38 @@
+// Copyright 2009, Squish Tech, LLC.
+#ifndef SRC_XML_STRING_H_
+#define SRC_XML_STRING_H_
+
+#include <v8.h>
+
+#include <libxml/xmlstring.h>
+
+#include <stddef.h>
+
+namespace libxmljs {
+
+// True when none of the |len| bytes has the high bit set.
+bool IsAscii(const char* str, size_t len);
+
+// Creates a JS string from |len| bytes of UTF-8, or up to the NUL when len
+// is negative. Every native string handed to JS goes through here.
+v8::Local<v8::String> NewString(const char* str, int len = -1);
+
+inline v8::Local<v8::String>
+NewString(const xmlChar* str, int len = -1) {
+  return NewString(reinterpret_cast<const char*>(str), len);
+}
+
+// Turns a string allocated by libxml2 (xmlNodeGetContent and friends) into
+// a JS string and takes ownership of it. ASCII values of at least the
+// external string threshold become external strings backed by the buffer
+// itself, so reading a large text node costs no copy; the buffer is freed
+// when V8 collects the string. Anything else is copied and freed now.
+v8::Handle<v8::String> AdoptXmlString(xmlChar* str, int len);
+
+// libxml.externalStringThreshold([bytes]) gets or sets the threshold.
+// Values shorter than it are always copied; 0 turns external strings off.
+v8::Handle<v8::Value> ExternalStringThreshold(const v8::Arguments& args);
+
+}  // namespace libxmljs
+
+#endif  // SRC_XML_STRING_H_